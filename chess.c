@@ -9,6 +9,27 @@
 #include <linux/string.h>
 #include <linux/slab.h>
 #include <linux/rwsem.h>
+#include <linux/atomic.h>
+#include <linux/moduleparam.h>
+#include <linux/bitops.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/sched.h>
+#include <linux/vmalloc.h>
+#include <linux/log2.h>
+#include <linux/sizes.h>
+#include <linux/workqueue.h>
+#include <linux/ktime.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/seqlock.h>
+#include <linux/math64.h>
+
+//the board, move generation and search, shared with the userspace tools
+#include "chess_engine.h"
+
+//the binary ioctl ABI
+#include "chess_ioctl.h"
 
 
 
@@ -16,9 +37,59 @@
 MODULE_LICENSE("GPL");
 
 
-//reader writer semaphore for synchronizing tictactoe resource access
-static DECLARE_RWSEM(board_lock);
-static DECLARE_RWSEM(resp_lock);
+/*only picks the in-check test check_or_mate() runs after each move,
+  inCheck() on the attack tables or mailboxCheck(), the original square
+  by square scan. Move generation and the search always use bitboards*/
+static bool bitboards = true;
+module_param(bitboards, bool, 0444);
+MODULE_PARM_DESC(bitboards, "In-check test after each move: 1 for the bitboard inCheck(), 0 for the mailbox scan (default: 1)");
+
+
+/*how hard the computer thinks on "03". A session can override any of
+  them with "05 D<depth>", "05 N<nodes>" or "05 T<ms>", 0 going back to
+  these defaults, and a single move with "03 N<nodes>" or "03 T<ms>".
+  Whichever budget runs out first ends the search*/
+static unsigned int search_depth = 4;
+module_param(search_depth, uint, 0644);
+MODULE_PARM_DESC(search_depth, "Maximum search depth of a computer move in plies (default: 4)");
+
+static unsigned long search_nodes;
+module_param(search_nodes, ulong, 0644);
+MODULE_PARM_DESC(search_nodes, "Node budget of a computer move, 0 for no limit (default: 0)");
+
+static unsigned int search_ms;
+module_param(search_ms, uint, 0644);
+MODULE_PARM_DESC(search_ms, "Time budget of a computer move in milliseconds, 0 for no limit (default: 0)");
+
+/*threads a computer move searches with. The first is the caller, the
+  others are Lazy SMP helpers run on search_wq. There is one set of
+  helpers for the whole module, see borrowHelpers()*/
+static unsigned int search_threads = 1;
+module_param(search_threads, uint, 0644);
+MODULE_PARM_DESC(search_threads, "Threads searching each computer move (default: 1)");
+
+/*the selective search techniques, all on by default. Each can be turned
+  off on its own to measure how many nodes it saves reaching a depth*/
+static bool search_null_move = true;
+module_param(search_null_move, bool, 0644);
+MODULE_PARM_DESC(search_null_move, "Null move pruning with verification (default: Y)");
+
+static bool search_lmr = true;
+module_param(search_lmr, bool, 0644);
+MODULE_PARM_DESC(search_lmr, "Late move reductions (default: Y)");
+
+static bool search_futility = true;
+module_param(search_futility, bool, 0644);
+MODULE_PARM_DESC(search_futility, "Futility and reverse futility pruning (default: Y)");
+
+static bool search_pvs = true;
+module_param(search_pvs, bool, 0644);
+MODULE_PARM_DESC(search_pvs, "Principal variation search (default: Y)");
+
+static bool search_aspiration = true;
+module_param(search_aspiration, bool, 0644);
+MODULE_PARM_DESC(search_aspiration, "Aspiration windows at the root (default: Y)");
+
 
 //response strings
 static char *OK = "OK\n";
@@ -31,190 +102,321 @@ static char *OOT = "OOT\n";
 static char *NOGAME = "NOGAME\n";
 static char *TIE = "TIE\n";
 
-//response buffer
-static char *response = "NOGAME\n";
-static size_t resplen = 7;
-
 //cmd string array
 //static char *commands[5] = {"00", "01", "02", "03", "04"}; 
 
+/*longest valid command is a perft from a FEN, "06 D10 <fen>\n", so every
+  command fits in a fixed buffer and never needs a kmalloc*/
+#define CMD_MAX (7 + CHESS_FEN_MAX)
+
+//several commands can be sent in one write(), up to BATCH_MAX bytes of them at a time
+#define BATCH_MAX 4096
+
+/*responses wait for read() in a ring of RING_SIZE bytes, a power of two.
+  A command only runs once there is room in it for the longest response
+  it can give, see responseRoom(), so nothing queued is ever dropped*/
+#define RING_SIZE 16384
 
-//board in string format and game elements
-static char boardstr[129];
-static bool game_initialized = false;
-static bool mated = false;
-static char turn = '\0';
-static char human = '\0';
-static char comp = '\0';
-
-static int games = 0;
-
-//2d array of char chess piece pointers 
-static char *board[8][8];
-
-/*this piece stores dynamically allocated pointers to promoted pawn strings.
-  necesary because when promoting, the statically declared strings can't be 
-  changed, and promoting a pawn requires this change. The pointers in this array
-  will all be freed in reset(). 
-  
-  Note that array size is 16 because only 16 promotions
-  are possible in the game (8 promotions for 8 pawns for each player)*/
-static char *promoted_pieces[16] = {NULL};
-
-/*this index keeps track of the next empty
- index in promoted_pieces[]*/
-static int index = 0;
-
-//chess pieces
-static char *EMPTY = "**";
-static char WHITE = 'W';
-static char BLACK = 'B';
-static char KING = 'K';
-static char QUEEN = 'Q';
-static char BISHOP = 'B';
-static char KNIGHT = 'N';
-static char ROOK = 'R';
-static char PAWN = 'P';
+//the longest response, a perft divide with a line per root move
+#define PERFT_OUT 6144
+
+//the longest response of any other command, the board
+#define RESP_MAX 129
+
+
+/*wire format chars for each colour and type code, used to translate
+  the board only at the protocol boundary*/
+static const char color_chars[3] = {'*', 'W', 'B'};
+static const char type_chars[7] = {'*', 'P', 'N', 'B', 'R', 'Q', 'K'};
 
 
 //this is the arrangement of pieces in row order
-//used by reset() to memcpy into the enum 2d array and reset
-static char *whites[2][8] ={{"WR", "WN", "WB", "WQ", "WK", "WB", "WN", "WR"}, {"WP", "WP", "WP", "WP", "WP", "WP", "WP", "WP"}};
-static char *blacks[2][8] ={{"BR", "BN", "BB", "BQ", "BK", "BB", "BN", "BR"}, {"BP", "BP", "BP", "BP", "BP", "BP", "BP", "BP"}}; 
+//used by reset() to memcpy into the 2d board array and reset
+static const u8 whites[2][8] = {
+    {WHITE | ROOK, WHITE | KNIGHT, WHITE | BISHOP, WHITE | QUEEN, WHITE | KING, WHITE | BISHOP, WHITE | KNIGHT, WHITE | ROOK}, 
+    {WHITE | PAWN, WHITE | PAWN, WHITE | PAWN, WHITE | PAWN, WHITE | PAWN, WHITE | PAWN, WHITE | PAWN, WHITE | PAWN}
+};
+static const u8 blacks[2][8] = {
+    {BLACK | ROOK, BLACK | KNIGHT, BLACK | BISHOP, BLACK | QUEEN, BLACK | KING, BLACK | BISHOP, BLACK | KNIGHT, BLACK | ROOK}, 
+    {BLACK | PAWN, BLACK | PAWN, BLACK | PAWN, BLACK | PAWN, BLACK | PAWN, BLACK | PAWN, BLACK | PAWN, BLACK | PAWN}
+}; 
+
+
+/*everything that makes up one game. Each open() of /dev/chess gets its
+  own session, hung off file->private_data, so independent games never
+  share a board or contend on the same locks*/
+struct game_session {
+
+    //reader writer semaphores for synchronizing this game's resources
+    struct rw_semaphore board_lock;
+    struct rw_semaphore resp_lock;
+
+    /*bumped around every change made under the write side of board_lock.
+      Readers that only copy a few fields out (the board dump, the turn
+      checks) retry on it instead of taking the semaphore, so they never
+      sleep or bounce the lock's cache line, see boardWriteLock()*/
+    seqcount_rwsem_t board_seq;
+
+    //the last command's response, also queued on ring for read()
+    char *response;
+    size_t resplen;
+
+    //board in string format and game elements
+    char boardstr[RESP_MAX];
+    bool game_initialized;
+    bool mated;
+    u8 turn;
+    u8 human;
+    u8 comp;
+
+    int games;
+
+    //the pieces on the board
+    struct position pos;
+
+    //number of moves made in the game
+    int moves;
+
+    /*bumped on every change to the board, so a search that ran without
+      board_lock can tell if its copy of the position went stale*/
+    unsigned int gen;
+
+    //search limits set by "05", 0 means the module parameters apply
+    unsigned int depth_limit;
+    u64 node_limit;
+    unsigned int time_limit;
+
+    /*limits of the one computer move under way, set along with thinking
+      by "03 N<nodes>", "03 T<ms>" or CHESS_IOC_SEARCH and used up by
+      computer_move(). 0 means the limits above apply*/
+    u64 move_nodes;
+    unsigned int move_ms;
+
+    /*the session's own search context, for its computer moves and
+      perft, allocated on the first of them. Helpers come from the
+      module wide set, see borrowHelpers()*/
+    struct mutex search_lock;
+    struct search *search;
+
+    /*"03" only queues move_work, which searches and then clears thinking
+      and wakes up wait. Until then reads and writes wait or fail with
+      -EAGAIN, and poll() reports nothing ready. thinking is protected by
+      resp_lock, move_err is handed back by the next read*/
+    struct work_struct move_work;
+    wait_queue_head_t wait;
+    bool thinking;
+    int move_err;
+
+    /*the computer's last move, MOVE_NONE if it had none, and the depth
+      its search completed, the nodes it took and how long*/
+    u16 last_move;
+    unsigned int last_depth;
+    u64 last_nodes;
+    u64 last_ns;
+
+    /*one write() at a time runs on the session under write_lock, which
+      also owns batch, the BATCH_MAX bytes a batch of commands is copied to*/
+    struct mutex write_lock;
+    char *batch;
+
+    //perft's response, PERFT_OUT bytes, only written under search_lock
+    char *perft_out;
+
+    /*responses not read yet, oldest first, under resp_lock. head and
+      tail only ever grow and index the ring modulo RING_SIZE*/
+    char *ring;
+    size_t head;
+    size_t tail;
+
+    /*the page mmap() hands out, see struct chess_state. state_lock
+      only orders the writers, readers never take a lock*/
+    struct chess_state *state;
+    struct mutex state_lock;
 
-//row of empty squares
-static char *empty[8] = {"**", "**", "**", "**", "**", "**", "**", "**"};
+};
 
-//x and y coordinates of the black and white kings' positions
-static int bkingpos[2] = {7, 4};
-static int wkingpos[2] = {0, 4};
 
+/*the only ways to change the board or the response. A writer still
+  excludes other writers with the semaphore, the seqcount tells
+  lockless readers to retry*/
+static void boardWriteLock(struct game_session *sess)
+{
+    down_write(&sess->board_lock);
+    write_seqcount_begin(&sess->board_seq);
+}
 
-//number of moves made in the game
-static int moves = 0;
 
+static void boardWriteUnlock(struct game_session *sess)
+{
+    write_seqcount_end(&sess->board_seq);
+    up_write(&sess->board_lock);
+}
 
 
-//validates the piece for correct color char and piece char
-static bool validPiece(char color, char piece)
+/*read() consumes the response ring, so the response side has no
+  lockless readers to tell and needs no seqcount*/
+static void respWriteLock(struct game_session *sess)
 {
-    if (color == WHITE || color == BLACK){
-        if (piece == KING || piece == QUEEN || piece == KNIGHT || piece == BISHOP || piece == ROOK || piece == PAWN){
-            return true;
-        }
-    }
+    down_write(&sess->resp_lock);
+}
+
+
+static void respWriteUnlock(struct game_session *sess)
+{
+    up_write(&sess->resp_lock);
+}
+
+
 
-    return false; 
+//whether the ring has room for a response of need bytes, see waitWrite()
+static bool ringRoom(struct game_session *sess, size_t need)
+{
+    return READ_ONCE(sess->tail) - READ_ONCE(sess->head) + need <= RING_SIZE;
 }
 
 
+/*the room the command in cmd needs in the ring, PERFT_OUT for a perft
+  and RESP_MAX for anything else, malformed commands included*/
+static size_t responseRoom(const char *cmd, size_t len)
+{
+    return (len >= 2 && cmd[0] == '0' && cmd[1] == '6') ? PERFT_OUT : RESP_MAX;
+}
 
-//validates the square to square coordinates  
-static bool validIndex(char rowa, char rowb, char cola, char colb){
-    bool valid = true;
 
-    if (rowa < 'a' || rowb < 'a' || rowa > 'h' || rowb > 'h'){
-        valid = false;
-    }
 
-    if (cola < '1' || colb < '1' || cola > '8' || colb > '8'){
-        valid = false;
-    }
+/*appends the response to the ring, under resp_lock. The command it
+  answers only ran once ringRoom() said it fits*/
+static void pushResponse(struct game_session *sess)
+{
+    size_t off, n;
 
-    return valid; 
+    off = sess->tail & (RING_SIZE - 1);
+    n = min(sess->resplen, (size_t) (RING_SIZE - off));
+
+    memcpy(sess->ring + off, sess->response, n);
+    memcpy(sess->ring, sess->response + n, sess->resplen - n);
+
+    sess->tail += sess->resplen;
 
+    //poll() reports the ring readable from here on
+    wake_up_interruptible(&sess->wait);
 }
 
 
-/*checks if a multi-square straight path a piece is moving on is unblocked
-  needs to be called only for rook, bishop, and queen*/
 
-static bool blocked(int i0, int i1, int j0, int j1)
+//queues the response of a command that is done with
+static void queueResponse(struct game_session *sess)
 {
-    //these are the increment variables, either 1 or -1
-    int di = 0, dj = 0;
-    //these are the x and y axis distances
-    int ilim = i1 - i0;
-    int jlim = j1 - j0;
+    respWriteLock(sess);
+    pushResponse(sess);
+    respWriteUnlock(sess);
+}
 
-    int i = 0, j = 0;
 
+//slab cache that every game session is allocated from
+static struct kmem_cache *session_cache;
 
-    /*it its a vertical path j increment = 1 and i increment = 0
-     and vice versa for horizontal path*/ 
-    if (i0 == i1){
-        dj = 1;
-    }
+/*module wide counters, reported through /sys/class/misc/chess/stats.
+  allocs counts every allocation the module makes so that it can be 
+  verified the move path itself never allocates*/
+static struct {
+    atomic64_t sessions;
+    atomic64_t commands;
+    atomic64_t allocs;
+
+    //transposition table probes, hits and live entries lost to another position
+    atomic64_t tt_probes;
+    atomic64_t tt_hits;
+    atomic64_t tt_collisions;
+
+    //beta cutoffs, and those given by the first move tried, see scoreMoves()
+    atomic64_t cutoffs;
+    atomic64_t first_cutoffs;
 
-    else if (j0 == j1){
-        di = 1;
+    //nodes searched by all threads, those in quiescence, and the time spent searching
+    atomic64_t nodes;
+    atomic64_t qnodes;
+    atomic64_t search_ns;
+} stats;
+
+
+//transposition table size in megabytes, see tt_mb_set()
+static unsigned int tt_mb = 16;
+
+
+
+//translates a wire format colour char into its colour code, 0 if invalid
+static u8 wireColor(char color)
+{
+    if (color == 'W'){
+        return WHITE;
     }
 
-    /* if its a diagonal path, then di and dj = +/- 1 */
+    if (color == 'B'){
+        return BLACK;
+    }
 
-    else{
-        if (ilim > 0){
-            di = 1;
-        } 
+    return 0;
+}
 
-        else{
-            di = -1;
-        }
 
-        if (jlim > 0){
-            dj = 1;
-        }
 
-        else{
-            dj = -1;
-        }
+//translates a wire format piece char into its type code, EMPTY if invalid
+static u8 wireType(char piece)
+{
+    switch (piece){
+    case 'P':
+        return PAWN;
+    case 'N':
+        return KNIGHT;
+    case 'B':
+        return BISHOP;
+    case 'R':
+        return ROOK;
+    case 'Q':
+        return QUEEN;
+    case 'K':
+        return KING;
+    default:
+        return EMPTY;
     }
+}
 
-    /*this ensures that ilim and jlim is positive (for the while loop below)
-     and yields the absolute value x and y axis travel distances*/
-    ilim = (i1 > i0) ? (i1 - i0) : (i0 - i1);
-    jlim = (j1 > j0) ? (j1 - j0) : (j0 - j1);
 
 
-    /*keeps going as long as there's an x or y axis
-      distance to cover. ilim = jlim for diagonal paths
-      
-      NOTE: the bound is ilim - 2 and jlim - 2 because we 
-      do not want to check the starting and ending positions.
-      we just want to see what pieces are STRICTLY inbetween 
-      blocking the path*/
-    while (i < ilim - 2 || j < jlim - 2){
+//validates the piece for correct color char and piece char
+static bool validPiece(char color, char piece)
+{
+    return wireColor(color) != 0 && wireType(piece) != EMPTY; 
+}
 
-        char *piece = board[i0 + di][j0 + dj];
 
-        /*if any one square is non empty, then path is blocked*/
-        if (strcmp(piece, EMPTY)){
-            return true;
-        }
 
-        /*go to the next square*/
+//validates the square to square coordinates  
+static bool validIndex(char rowa, char rowb, char cola, char colb){
+    bool valid = true;
 
-        i0 += di;
-        j0 += dj;
-        i++;
-        j++;
+    if (rowa < 'a' || rowb < 'a' || rowa > 'h' || rowb > 'h'){
+        valid = false;
+    }
 
+    if (cola < '1' || colb < '1' || cola > '8' || colb > '8'){
+        valid = false;
     }
 
-    /*otherwise path is clear*/
-    return false;
+    return valid; 
 
 }
 
 
-
-static bool validate(char *cmd, size_t len)
+static bool validate(struct game_session *sess, char *cmd, size_t len)
 {
     /*these exist for locking purposes to check if 
       changing the response string is necessary (since its a shared variable as well)
     */
     char *resp = NULL;
     bool error = false;
+    size_t i;
 
     //validate the first two characters that make up the command
     if (cmd[0] != '0'){
@@ -222,7 +424,7 @@ static bool validate(char *cmd, size_t len)
         error = true;
     }
 
-    if (cmd[1] != '0' && cmd[1] != '1' && cmd[1] != '2' && cmd[1] != '3' && cmd[1] != '4'){
+    if (cmd[1] != '0' && cmd[1] != '1' && cmd[1] != '2' && cmd[1] != '3' && cmd[1] != '4' && cmd[1] != '5' && cmd[1] != '6'){
         resp = UNKCMD;
         error = true;
     }
@@ -243,8 +445,8 @@ static bool validate(char *cmd, size_t len)
             error = true;
         }
 
-        //make sure right piece color choice char is included 
-        if ((cmd[3] != WHITE && cmd[3] != BLACK) || cmd[4] != '\n'){
+        //make sure right piece color choice char is included, once cmd[4] is known to be in it
+        else if (wireColor(cmd[3]) == 0 || cmd[4] != '\n'){
             resp = INVFMT;
             error = true;
         }
@@ -260,10 +462,9 @@ static bool validate(char *cmd, size_t len)
             error = true;
         }
 
-        //check string format up to the starting to ending move position part
-
-        
-        if (!(validPiece(cmd[3], cmd[4])) || !(validIndex(cmd[5], cmd[8], cmd[6], cmd[9]))){
+        /*check string format up to the starting to ending move position part,
+          only once the length says cmd[9] and beyond are in the command*/
+        else if (!(validPiece(cmd[3], cmd[4])) || !(validIndex(cmd[5], cmd[8], cmd[6], cmd[9]))){
             resp = INVFMT;
             error = true; 
         }
@@ -285,16 +486,67 @@ static bool validate(char *cmd, size_t len)
             }
         }
     }  
+
+
+    else if (cmd[1] == '3'){
+
+        //"03\n", or one move's budget, "03 N100000\n" or "03 T250\n"
+        if (len != 3 && (len < 6 || cmd[2] != ' ' || (cmd[3] != 'N' && cmd[3] != 'T'))){
+            resp = INVFMT;
+            error = true;
+        }
+
+        for (i = 4; i < len - 1; i++){
+            if (cmd[i] < '0' || cmd[i] > '9'){
+                resp = INVFMT;
+                error = true;
+            }
+        }
+    }
+
+
+    else if (cmd[1] == '5'){
+
+        //a limit letter and at least one digit, "05 D6\n", "05 N100000\n" or "05 T250\n"
+        if (len < 6 || cmd[2] != ' ' || (cmd[3] != 'D' && cmd[3] != 'N' && cmd[3] != 'T')){
+            resp = INVFMT;
+            error = true;
+        }
+
+        for (i = 4; i < len - 1; i++){
+            if (cmd[i] < '0' || cmd[i] > '9'){
+                resp = INVFMT;
+                error = true;
+            }
+        }
+    }
+
+
+    else if (cmd[1] == '6'){
+
+        //"06 P5\n" or "06 D5 <fen>\n", the fen itself is checked by parseFen()
+        if (len < 6 || cmd[2] != ' ' || (cmd[3] != 'P' && cmd[3] != 'D') || cmd[4] < '0' || cmd[4] > '9'){
+            resp = INVFMT;
+            error = true;
+        }
+
+        for (i = 5; i < len - 1 && cmd[i] != ' '; i++){
+            if (cmd[i] < '0' || cmd[i] > '9'){
+                resp = INVFMT;
+                error = true;
+            }
+        }
+    }
  
 
     /*if the string is valid, the board_lock will never be taken
       and in the long run, increases concurrency
     */  
     if (error){
-        down_write(&resp_lock);
-        response = resp;
-        resplen = 7;
-        up_write(&resp_lock);
+        respWriteLock(sess);
+        sess->response = resp;
+        sess->resplen = 7;
+        respWriteUnlock(sess);
 
         return false;
     
@@ -306,623 +558,712 @@ static bool validate(char *cmd, size_t len)
 
 
 
-static void reset(char piece)
+static void reset(struct game_session *sess, u8 piece)
 {
-    
-    int i;
-
-    //delete all the promoted pieces stored and set to null
-    for (i = 0; i < 16; i++){
-        if (promoted_pieces[i] != NULL){
-            kfree(promoted_pieces[i]);
-            promoted_pieces[i] = NULL;
-        }
-    }
-
-    index = 0;
 
     //this resets the white and black sides to original formation
-    memcpy(board[0], whites[0], 8 * sizeof(char *));
-    memcpy(board[1], whites[1], 8 * sizeof(char *));
-    memcpy(board[7], blacks[0], 8 * sizeof(char *));
-    memcpy(board[6], blacks[1], 8 * sizeof(char *));
+    memcpy(sess->pos.board[0], whites[0], 8);
+    memcpy(sess->pos.board[1], whites[1], 8);
+    memcpy(sess->pos.board[7], blacks[0], 8);
+    memcpy(sess->pos.board[6], blacks[1], 8);
 
 
-    //this loop fills out the blank spaces in the board
-    for (i = 2; i < 6; i++){
-        memcpy(board[i], empty, 8 * sizeof(char *));
-    }
+    //this fills out the blank spaces in the board
+    memset(sess->pos.board[2], EMPTY, 4 * 8);
+
+    syncBitboards(&sess->pos);
 
     //reset game variables
-    games++;
-    game_initialized = true;
-    mated = false;
-    moves = 0;
-
-    wkingpos[0] = 0;
-    wkingpos[1] = 4;
-    bkingpos[0] = 7;
-    bkingpos[1] = 4;
+    sess->games++;
+    sess->game_initialized = true;
+    sess->mated = false;
+    sess->moves = 0;
+    sess->gen++;
+    sess->last_move = 0;    //MOVE_NONE, the computer has not moved
     
-    human = piece;
+    sess->human = piece;
 
     // set turn 
     if (piece == WHITE){
-        comp = BLACK;
-        turn = human;
+        sess->comp = BLACK;
+        sess->turn = sess->human;
     }
 
 
     else{
-        comp = WHITE;
-        turn = comp;
+        sess->comp = WHITE;
+        sess->turn = sess->comp;
     }
 
 }
 
-static bool check(int i, int j, char player)
+/*the check, mate and stalemate test once player's opponent has moved.
+  It works on a private copy of the position taken without a lock, so
+  the board is only written when the game is over. In check the
+  response becomes CHECK, or MATE if there is no legal move out of it,
+  and with no legal move and no check it becomes TIE. Returns the
+  result code of the response it set, CHESS_OK if it left it alone*/
+static int check_or_mate(struct game_session *sess, u8 player)
 {
-    /*the idea is to start from the king's square
-      and work our way outwards linearly along all
-      8 directions to see if there is a check by an 
-      opponent's piece*/
-
-    //this is the increment variable for spanning to outward squares
-    int inc = 1;
-
-    /* arrays of x and y coordinate travel paths
-       varies by incrementing inc. each combination of elements
-       in iindexes and jiindexes represents one of 8 possible directions spanning 
-       outward from square (i, j).*/ 
-    int iindexes[3] = {i + inc, i - inc, i};
-    int jindexes[3] = {j + inc, j - inc, j};
-
-    
-    int k = 0, l = 0, m = 0, n = 0;
+    struct position pos;
+    unsigned int seq, gen;
+    bool check, moves;
+    int result;
+
+    do {
+        seq = read_seqcount_begin(&sess->board_seq);
+        pos = sess->pos;
+        gen = sess->gen;
+    } while (read_seqcount_retry(&sess->board_seq, seq));
+
+    //either engine, mate and stalemate are always down to the legal moves
+    check = bitboards ? inCheck(&pos, player) : mailboxCheck(&pos, player);
+    moves = hasLegalMove(&pos, player);
+
+    if (!check && moves){
+        return CHESS_OK;
+    }
 
-    /*this array keeps track of whether or not each of the
-      8 different directions should be checked*/
-    int dir[3][3] = {0};    
-    
-    /*this is searching for any horses that may be 
-      putting the king in check */
+    if (!moves){
+        boardWriteLock(sess);
 
-    /* x and y travel displacement values;
-       each combination of dx and dy elements 
-       represents one of a horse's 8 possible 
-       L shaped paths */ 
+        //a game started since is not the one that just ended
+        if (sess->gen != gen){
+            boardWriteUnlock(sess);
+            return CHESS_OK;
+        }
 
-    int dx[2] = {1 , -1};
-    int dy[2] = {2, -2};
+        sess->mated = check;
+        sess->game_initialized = false;
 
-    char *piece1 = NULL;
-    char *piece2 = NULL;
+        boardWriteUnlock(sess);
+    }
 
-    char color1 = 0, type1 = 0, color2 = 0, type2 = 0;
+    respWriteLock(sess);
 
-    char opponent;
+    if (moves){
+        sess->response = CHECK;
+        sess->resplen = 6;
+        result = CHESS_CHECK;
+    }
 
-    if (player == WHITE){
-        opponent = BLACK;
+    else if (check){
+        sess->response = MATE;
+        sess->resplen = 5;
+        result = CHESS_MATE;
     }
 
     else{
-        opponent = WHITE;
+        sess->response = TIE;
+        sess->resplen = 4;
+        result = CHESS_TIE;
     }
-    
 
-    down_read(&board_lock);
+    respWriteUnlock(sess);
 
-    /*iterating through possible horse paths*/
+    return result;
+}
 
-    for (k = 0; k < 2; k++){
-        m = dx[k];
-        
-        for (l = 0; l < 2; l++){
-            n = dy[l];
-            
 
-            /*check if indices are valid*/
 
-            if (i + m < 7 && i + m > 0 && j + n < 7 && j + n > 0){
-                piece1 = board[i + m][j + n];
-                color1 = piece1[0];
-                type1 = piece1[1];
-            }
+/*every search holds this for reading for as long as it runs and a resize
+  takes it for writing, so the table can't go away under a search while
+  the probes and stores themselves never touch a lock*/
+static DECLARE_RWSEM(tt_lock);
 
-            
-            if (i + n < 7 && i + n > 0 && j + m < 7 && j + m > 0){
-                piece2 = board[i + n][j + m];
-                color2 = piece2[0];
-                type2 = piece2[1];
-            }
-            
-            /* check if the piece is an opponent's horse
-               return check if yes */
-            if ((color1 != player && type1 == KNIGHT) || (color2 != player && type2 == KNIGHT)){
-                goto yes;
-            } 
-            
-        }
-        
-    }
-    
-   
+//bumped by every search, entries left by older searches are replaced first
+static atomic_t tt_age;
 
-    /*its while inc < 8 because max dimension span length 
-      for length, width, or diagonals is only 8 squares*/ 
-    while (inc < 8){
-        
-        for (k = 0; k < 3; k++){
-            
-            m = iindexes[k];
-    
-            //makes sure that we dont exceed the board dimensions
-            if (m > 7 || m < 0){
-                continue;
-            }
+//unbound workqueue the Lazy SMP helper searches run on
+static struct workqueue_struct *search_wq;
 
-            for (l = 0; l < 3; l++){ 
+/*unbound workqueue the computer moves of "03" run on. It is separate
+  from search_wq so a move waiting on its helpers never holds up the
+  helpers' queue*/
+static struct workqueue_struct *move_wq;
 
-                n = jindexes[l];
 
-                /*
-                printk("m is: %d\n", m);
-                printk("n is: %d\n", n);
-                */
+//swaps in a new, empty table of mb megabytes. Needs tt_lock for writing once the device exists
+static int ttResize(unsigned int mb)
+{
+    unsigned long buckets = rounddown_pow_of_two((unsigned long) mb * SZ_1M / sizeof(struct tt_bucket));
+    struct tt_bucket *table = vzalloc(buckets * sizeof(struct tt_bucket));
 
-                /* if this direction should not be checked,
-                   or if its the origin king square, then 
-                   pass this iteration*/
-    
-                if (dir[k][l] == 1 || (m == i && n == j)){
-                    continue;
-                }
-                
-                if (n > 7 || n < 0){
-                    continue;
-                }
+    if (table == NULL){
+        return -ENOMEM;
+    }
 
-                //we don't need to check square (i, j); its the king's square    
-                if (m == i && n == j){
-                    continue;
-                }
+    atomic64_inc(&stats.allocs);
 
-                else{
-                    char *piece = board[m][n];
-                    char color = piece[0];
-                    char type = piece[1];
-
-                    /*path is blocked by your piece so no need
-                      to ever check this direction again*/
-
-                    if (color == player){
-                        dir[k][l] = 1;
-                        continue;
-                    }
-
-                    /*if its opponent piece, check piece types with
-                      respect to the direction*/ 
-
-                    else {
-                        //this is for vertical-horizontal directions
-                        
-                        if (inc == 1 && type == KING){
-                            goto yes;
-                        }
-                        
-                        else if (type == QUEEN){
-                            goto yes;
-                        }
-
-                        else if ((m == i || n == j)){
-                            if (type == ROOK){
-                                goto yes;
-                            }
-                        }
-                        
-                
-                        //this is for diagonal directions
-
-                        else if (type == BISHOP){
-                            goto yes;
-                        }
-
-                        else if (inc == 1 && type == PAWN){
-
-                            /* check if the pawns are checking the king from
-                               the correct side. the pawn might be behind the king
-                               on the other side of the board and not pose a threat*/
-
-                            if (player == WHITE && m > i ){
-                                goto yes;
-                            }
-
-                            else if (player == BLACK && m < i){
-                                goto yes;
-                            } 
-                        } 
-                        
-                        /* if the piece is non-threatening and not empty,
-                           then there is no more need to keep
-                           checking this direction. But the "piece
-                           could be a blank char, so this check
-                           is necessary*/
-                        if (color == opponent){   
-                            dir[k][l] = 1;
-                        }
-
-                    }
-                }
-            }
-        }
-        
-        inc++;
+    vfree(tt);
+    tt = table;
+    tt_mask = buckets - 1;
+    tt_mb = mb;
 
-        /*ISO C90 forbids redeclaring the iindexes 
-          and jindexes array at top of while loop, so
-          the array elements have to be reset manually*/ 
-        iindexes[0] = i + inc;
-        iindexes[1] = i - inc;
-        iindexes[2] = i;
-        jindexes[0] = j + inc;
-        jindexes[1] = j - inc;    
-        jindexes[2] = j;
+    return 0;
+}
 
-    }   
 
-    up_read(&board_lock);
+/*writing /sys/module/chess/parameters/tt_mb resizes the table, which
+  is only allowed while no search is running*/
+static int tt_mb_set(const char *val, const struct kernel_param *kp)
+{
+    unsigned int mb;
+    int rv = kstrtouint(val, 0, &mb);
 
-    return false;
+    if (rv){
+        return rv;
+    }
 
-yes:
-    up_read(&board_lock);
-    return true;
+    if (mb == 0 || mb > TT_MB_MAX){
+        return -EINVAL;
+    }
+
+    //given at load time, game_init() allocates the table
+    if (tt == NULL){
+        tt_mb = mb;
+        return 0;
+    }
 
+    if (!down_write_trylock(&tt_lock)){
+        return -EBUSY;
+    }
+
+    rv = ttResize(mb);
+    up_write(&tt_lock);
+
+    return rv;
 }
 
+static const struct kernel_param_ops tt_mb_ops = {
+    .set = tt_mb_set,
+    .get = param_get_uint,
+};
 
+module_param_cb(tt_mb, &tt_mb_ops, &tt_mb, 0644);
+MODULE_PARM_DESC(tt_mb, "Transposition table size in megabytes, resizable while idle (default: 16)");
 
 
 
-/*checks if a king is mated*/
+//runs a Lazy SMP helper on search_wq
+static void helperSearch(struct work_struct *work)
+{
+    struct search *h = container_of(work, struct search, work);
 
-static bool mate(int i, int j, char player)
-{  
+    think(h);
+}
 
-    int k, l;
-    int m, n;
 
-    char* king = NULL;
+/*the Lazy SMP helpers' search contexts, one set for the whole module
+  so a session never holds more than its own. One computer move at a
+  time borrows them all under helper_lock*/
+static DEFINE_MUTEX(helper_lock);
+static struct search *helpers;
+static unsigned int nhelpers;
 
-    //up_read(&board_lock);
-    down_write(&board_lock);
 
-    /*store the king position coordinates*/
+/*lends a computer move of nthreads threads its helpers, resizing the
+  set when search_threads has changed. Returns how many it got, 0 when
+  another move has them or they can't be allocated, and the move then
+  searches on its own. Anything but 0 has to go back to returnHelpers()*/
+static unsigned int borrowHelpers(unsigned int nthreads)
+{
+    unsigned int k;
 
-    if (player == WHITE){
-        i = wkingpos[0];
-        j = wkingpos[1];
-    
+    if (nthreads <= 1 || !mutex_trylock(&helper_lock)){
+        return 0;
     }
 
-    else{
-        i = bkingpos[0];
-        j = bkingpos[1];
+    if (nhelpers != nthreads - 1){
+        kvfree(helpers);
+        nhelpers = 0;
 
-    }
+        //zeroed, the history tables carry over from one search to the next
+        helpers = kvcalloc(nthreads - 1, sizeof(*helpers), GFP_KERNEL);
 
-    /*this is necessary because when we are checking the safety of the 
-      king's surrounding squares, we dont want to mistake the king piece
-      that's still in the original position as a blocking piece that protects the king.*/
-    king = board[i][j];
-    board[i][j] = EMPTY;
+        if (helpers == NULL){
+            mutex_unlock(&helper_lock);
+            return 0;
+        }
 
-    up_write(&board_lock);
+        atomic64_inc(&stats.allocs);
 
-    /*braces added to allow declaration of the two below arrays since we
-      can't declare array at the very top of the function and then
-      initialize it as a whole array*/  
-    {
-        /*these two arrays are the possible x and y values of the squares
-        surrounding the king's current position*/ 
-        int iindexes[3] = {i + 1, i - 1, i};
-        int jindexes[3] = {j + 1, j - 1, j};
+        for (k = 0; k < nthreads - 1; k++){
+            INIT_WORK(&helpers[k].work, helperSearch);
+        }
 
+        nhelpers = nthreads - 1;
+    }
 
-        /*same kind of iteration method as check()
-          except we are only looking at squares adjacent
-          to the king's square and seeing if there exists a 
-          square that the king can legally move to */
+    return nhelpers;
+}
 
-        for (k = 0; k < 3; k++){
-            m = iindexes[k];
 
-            //makes sure that we dont exceed the board dimensions
-            if (m > 7 || m < 0){
-                continue;
-            }
+static void returnHelpers(unsigned int n)
+{
+    if (n){
+        mutex_unlock(&helper_lock);
+    }
+}
 
-            for (l = 0; l < 3; l++){
-                n = jindexes[l];
 
-                //makes sure that we dont exceed the board dimensions
-                if (n > 7 || n < 0){
-                    continue;
-                }
+/*Lazy SMP. The n helpers search the same root as the main search s,
+  with nothing shared but the transposition table. Odd helpers start a
+  ply deeper so the threads spread over different depths and fill the
+  table with different parts of the tree for each other. Once the main
+  search is done the helpers are stopped, and the move of whichever
+  thread completed the deepest iteration is played. Called with tt_lock
+  held for reading*/
+static u16 smpSearch(struct search *s, struct search *team, unsigned int n)
+{
+    unsigned int depth;
+    unsigned int k;
+    u16 best;
+
+    s->main = s;
+    s->start_depth = 1;
+    s->finished = false;
+    s->age = (u8) atomic_inc_return(&tt_age);
+
+    for (k = 0; k < n; k++){
+        struct search *h = &team[k];
+
+        h->pos = s->pos;
+        h->side = s->side;
+        h->age = s->age;
+        h->max_depth = s->max_depth;
+        h->node_limit = 0;
+        h->time_limit = 0;
+        h->features = s->features;
+        h->main = s;
+        h->start_depth = min(1 + ((k + 1) & 1), s->max_depth);
+
+        queue_work(search_wq, &h->work);
+    }
 
-                if (m == i && n == j){
-                    continue;
-                }
+    think(s);
 
-                else{
-                    char *piece = board[m][n];
-                    char color = piece[0];
+    WRITE_ONCE(s->finished, true);
 
-                    /*if not in check and square is either empty or its an opponent's piece
-                      then king is not mated
-                      */
-                    if ((!check(m, n, player)) && (!strcmp(piece, EMPTY) || color != player)){
+    best = s->best;
+    depth = s->depth_done;
 
-                        //set the king back in its place
-                        down_write(&board_lock);
-                        board[i][j] = king;
-                        up_write(&board_lock);
+    for (k = 0; k < n; k++){
+        struct search *h = &team[k];
 
-                        return false;
+        flush_work(&h->work);
 
-                    }
-                }
-            }
+        if (h->best != MOVE_NONE && h->depth_done > depth){
+            best = h->best;
+            depth = h->depth_done;
         }
     }
-    
-    
-    down_write(&board_lock);
 
-    //set the king back in its place
-    board[i][j] = king;
-    mated = true;
-    game_initialized = false;
-    
-    up_write(&board_lock);
-    
-    return true;
+    //the team's result is left in the main search
+    s->best = best;
+    s->depth_done = depth;
 
+    return best;
 }
 
 
-static bool check_or_mate(int i, int j, char player)
+
+//adds what search s counted to the module's stats, and returns its nodes
+static u64 searchStats(const struct search *s)
 {
-    /*calling mate() after calling check() in a nested 
-      if statement because check needs to be true for 
-      mate to be true*/
+    atomic64_add(s->nodes, &stats.nodes);
+    atomic64_add(s->qnodes, &stats.qnodes);
+    atomic64_add(s->tt_probes, &stats.tt_probes);
+    atomic64_add(s->tt_hits, &stats.tt_hits);
+    atomic64_add(s->tt_collisions, &stats.tt_collisions);
+    atomic64_add(s->cutoffs, &stats.cutoffs);
+    atomic64_add(s->first_cutoffs, &stats.first_cutoffs);
+
+    return s->nodes;
+}
 
-    if (check(i, j, player)){
-        down_write(&resp_lock);
-    
-        response = CHECK;
-        resplen = 6;
 
-       
-        if (mate(i, j, player)){
-        
-            response = MATE;
-            resplen = 5;
-            up_write(&resp_lock);
 
-            return true;
-        
-        }
-        
-        up_write(&resp_lock);
+//makes sure sess has its search context. Called with search_lock held
+static int searchContext(struct game_session *sess)
+{
+    if (sess->search != NULL){
+        return 0;
+    }
 
-        return true;
+    //zeroed, the history table carries over from one search to the next
+    sess->search = kvzalloc(sizeof(*sess->search), GFP_KERNEL);
 
+    if (sess->search == NULL){
+        return -ENOMEM;
     }
 
-    return false;
+    atomic64_inc(&stats.allocs);
 
+    return 0;
 }
 
 
 
-
-
-/*computer only moves the king. The computer
-  will always make a legal move by moving only
-  the king until the king is mated or a stalemate 
-  occurs*/  
-
-static void computer_move(void)
+//SEARCH_* mask of the techniques turned on by module parameter
+static unsigned int searchFeatures(void)
 {
-    //char *src = NULL;
-    char *resp = NULL;
-    size_t len = 0;
+    unsigned int features = 0;
 
-    char *king = NULL;
-    bool white = false, black = false, computer = false;
-    
-    int i, j, k, l, m, n;
+    if (READ_ONCE(search_null_move)){
+        features |= SEARCH_NULL_MOVE;
+    }
 
-    down_read(&board_lock);
+    if (READ_ONCE(search_lmr)){
+        features |= SEARCH_LMR;
+    }
 
-    if (turn == comp){
-        computer = true;
+    if (READ_ONCE(search_futility)){
+        features |= SEARCH_FUTILITY;
     }
 
-    if (comp == WHITE){
-        white = true;
-        i = wkingpos[0];
-        j = wkingpos[1];
+    if (READ_ONCE(search_pvs)){
+        features |= SEARCH_PVS;
     }
 
-    else{
-        black = true;
-        i = bkingpos[0];
-        j = bkingpos[1];
+    if (READ_ONCE(search_aspiration)){
+        features |= SEARCH_ASPIRATION;
     }
 
-    up_read(&board_lock);
+    return features;
+}
 
-    
-    if (computer){
-        down_write(&board_lock);
 
-        /*moves a center pawn if its black or white's
-          first move*/
 
-        if (moves <= 1){
-            if (white){
-                char *pawn = board[1][4];
-                board[3][4] = pawn;
-                board[1][4] = EMPTY;
+/*the computer searches a private copy of the position, so board_lock is
+  only held to take the copy and to apply the move. If the board changed
+  while it was thinking (a new game was started) the move is thrown away.
+  A move made is followed by the check, mate and stalemate test for the
+  human. Returns the result code of the response, or -ENOMEM if the
+  search context could not be allocated*/
 
-                moves++;
-                turn = human;
-                resp = OK;
-                len = 3;
+static int computer_move(struct game_session *sess)
+{
+    char *resp = NULL;
+    size_t len = 0;
+    int result;
+
+    struct search *s = NULL;
+    unsigned int nthreads = clamp(READ_ONCE(search_threads), 1U, (unsigned int) MAX_THREADS);
+    unsigned int gen;
+    unsigned int k, n;
+    unsigned int ms;
+    u64 start, ns;
+    u64 nodes = 0;
+    u16 move;
+    u8 piece;
+    bool moved = false;
+
+    //this move's own budget, used up whether or not it gets searched
+    u64 move_nodes = xchg(&sess->move_nodes, 0);
+    unsigned int move_ms = xchg(&sess->move_ms, 0);
+
+    //only one search per session at a time, it owns sess->search
+    mutex_lock(&sess->search_lock);
+
+    if (searchContext(sess)){
+        mutex_unlock(&sess->search_lock);
+        return -ENOMEM;
+    }
 
-                up_write(&board_lock);
-                goto ret;
+    s = sess->search;
 
-            }
+    down_read(&sess->board_lock);
 
-            else{
-                char *pawn = board[6][4];
-                board[4][4] = pawn;
-                board[6][4] = EMPTY;
-
-                moves++;
-                turn = human;
-                resp = OK;
-                len = 3;
-                
-                up_write(&board_lock);
-                goto ret;
-            }
+    if (sess->turn != sess->comp || !sess->game_initialized){
+        up_read(&sess->board_lock);
 
-        }
+        resp = OOT;
+        len = 4;
+        result = CHESS_OOT;
+        goto ret;
+    }
 
-        /*after first move, move the king*/
+    s->pos = sess->pos;
+    s->side = sess->comp;
+    gen = sess->gen;
 
-        else{
-            king = board[i][j];
-            board[i][j] = EMPTY;
-
-            up_write(&board_lock);
-
-            {
-                /*this is the same iterative method as mate()
-                  modified to move the king if there is a non checked
-                  legal square */
-
-                int iindexes[3] = {i + 1, i - 1, i};
-                int jindexes[3] = {j + 1, j - 1, j};
-
-                for (k = 0; k < 3; k++){
-                    m = iindexes[k];
-
-                    //makes sure that we dont exceed the board dimensions
-                    if (m > 7 || m < 0){
-                        continue;
-                    }
-
-                    for (l = 0; l < 3; l++){
-                        n = jindexes[l];
-
-                        //makes sure that we dont exceed the board dimensions
-                        if (n > 7 || n < 0){
-                            continue;
-                        }
-
-                        if (m == i && n == j){
-                            continue;
-                        }
-
-                        else{
-                            char *piece = board[m][n];
-                            char color = piece[0];
-                            
-                            /*if not in check and square is either empty or its an opponent's piece*/
-                            if (!check(m, n, comp)){
-
-                                if((!strcmp(piece, EMPTY)) || color != comp){
-            
-                                    down_write(&board_lock);
-
-                                    /*set the king back in its place*/
-                                    board[m][n] = king;
-                                    board[i][j] = EMPTY;
-
-                                    /*update king position*/
-                                    if (white){
-                                        wkingpos[0] = m;
-                                        wkingpos[1] = n;
-                                    }
-
-                                    else{
-                                        bkingpos[0] = m;
-                                        bkingpos[1] = n;
-                                    }
-
-                                    turn = human;
-                                    resp = OK;
-                                    len = 3;
-                                    moves++;
-
-                                    up_write(&board_lock);
-                                    goto ret;
-
-                                }
-                            }
-                        }     
-                    }
-                }
-            }
-        }
+    s->max_depth = sess->depth_limit ? sess->depth_limit : search_depth;
+    s->node_limit = sess->node_limit ? sess->node_limit : search_nodes;
+    ms = sess->time_limit ? sess->time_limit : search_ms;
+    s->features = searchFeatures();
 
+    up_read(&sess->board_lock);
 
-        /* if program flow reaches this code,
-           then that means computer couldn't make a
-           move (stalemate) */
+    s->max_depth = clamp(s->max_depth, 1U, (unsigned int) MAX_DEPTH);
 
-        down_write(&board_lock);
+    if (move_nodes){
+        s->node_limit = move_nodes;
+    }
 
-        board[i][j] = king;
-        turn = human;
-        game_initialized = false;
+    if (move_ms){
+        ms = move_ms;
+    }
 
-        up_write(&board_lock);
+    s->time_limit = (u64) ms * NSEC_PER_MSEC;
 
-        resp = TIE;
-        len = 4;
+    //the table can't be resized while any search holds tt_lock
+    down_read(&tt_lock);
+
+    n = borrowHelpers(nthreads);
+
+    start = ktime_get_ns();
+    move = smpSearch(s, helpers, n);
+    ns = ktime_get_ns() - start;
+    atomic64_add(ns, &stats.search_ns);
+
+    up_read(&tt_lock);
+
+    nodes = searchStats(s);
 
+    for (k = 0; k < n; k++){
+        nodes += searchStats(&helpers[k]);
     }
 
-    else{
+    returnHelpers(n);
+
+    boardWriteLock(sess);
+
+    //the game was reset or moved on underneath the search
+    if (sess->gen != gen){
+        boardWriteUnlock(sess);
+
         resp = OOT;
         len = 4;
+        result = CHESS_OOT;
+        goto ret;
+    }
+
+    sess->last_move = move;
+    sess->last_depth = s->depth_done;
+    sess->last_nodes = nodes;
+    sess->last_ns = ns;
+
+    //no legal move, the computer is either mated or stalemated
+    if (move == MOVE_NONE){
+        sess->game_initialized = false;
+
+        if (inCheck(&sess->pos, sess->comp)){
+            sess->mated = true;
+            resp = MATE;
+            len = 5;
+            result = CHESS_MATE;
+        }
+
+        else{
+            resp = TIE;
+            len = 4;
+            result = CHESS_TIE;
+        }
+
+        boardWriteUnlock(sess);
+        goto ret;
+    }
+
+    piece = pieceAt(&sess->pos, MOVE_FROM(move));
+
+    if (MOVE_PROMO(move) != EMPTY){
+        piece = sess->comp | MOVE_PROMO(move);
     }
 
+    setSquare(&sess->pos, MOVE_TO(move), piece);
+    setSquare(&sess->pos, MOVE_FROM(move), EMPTY);
+
+    sess->moves++;
+    sess->gen++;
+    sess->turn = sess->human;
+    sess->pos.key ^= zobrist_side;
+
+    verifyKey(&sess->pos, sess->turn);
+
+    boardWriteUnlock(sess);
+
+    resp = OK;
+    len = 3;
+    result = CHESS_OK;
+    moved = true;
 
 ret:
 
-    down_write(&resp_lock);
-    response = resp;
-    resplen = len;
-    up_write(&resp_lock);
+    mutex_unlock(&sess->search_lock);
+
+    respWriteLock(sess);
+    sess->response = resp;
+    sess->resplen = len;
+    respWriteUnlock(sess);
+
+    if (moved){
+        result = check_or_mate(sess, sess->human);
+    }
+
+    return result;
+
+}
+
+
+
+/*runs perft depth plies below fen, or the starting position if fen is
+  NULL, on the session's search context, which is left holding the
+  root moves and the count below each. Called with search_lock held.
+  Returns the number of root moves, -EINVAL for a bad fen, -EINTR if a
+  signal cut it short or -ENOMEM*/
+static int perftRun(struct game_session *sess, const char *fen, unsigned int depth, u64 *nodes, u64 *ns)
+{
+    struct search *s;
+    u64 start;
+    int n, k;
+
+    if (searchContext(sess)){
+        return -ENOMEM;
+    }
+
+    s = sess->search;
+
+    if (!parseFen(fen ? fen : start_fen, &s->pos, &s->side)){
+        return -EINVAL;
+    }
+
+    start = ktime_get_ns();
+    n = perftDivide(s, depth);
+    *ns = ktime_get_ns() - start;
+
+    if (s->stopped){
+        return -EINTR;
+    }
+
+    *nodes = 0;
+
+    for (k = 0; k < n; k++){
+        *nodes += s->divide[k];
+    }
+
+    return n;
+}
+
+
+
+
+
+/*checks that a game is on and that it is side's turn, and returns
+  CHESS_OK if so. Otherwise the response is set to NOGAME or OOT and
+  that code is returned*/
+static int myTurn(struct game_session *sess, u8 side)
+{
+    char *resp;
+    size_t len;
+    unsigned int seq;
+    int result;
+
+    do {
+        seq = read_seqcount_begin(&sess->board_seq);
+
+        resp = NULL;
+        len = 0;
+        result = CHESS_OK;
+
+        if (!sess->game_initialized){
+            resp = NOGAME;
+            len = 7;
+            result = CHESS_NOGAME;
+        }
+
+        else if (sess->turn != side){
+            resp = OOT;
+            len = 4;
+            result = CHESS_OOT;
+        }
+
+    } while (read_seqcount_retry(&sess->board_seq, seq));
+
+    if (resp == NULL){
+        return CHESS_OK;
+    }
+
+    respWriteLock(sess);
+    sess->response = resp;
+    sess->resplen = len;
+    respWriteUnlock(sess);
+
+    return result;
+}
+
+
+
+//marks a computer move as under way on sess, -EBUSY if one already is
+static int claimMove(struct game_session *sess)
+{
+    int rv = 0;
+
+    respWriteLock(sess);
+
+    if (sess->thinking){
+        rv = -EBUSY;
+    }
+
+    else{
+        sess->thinking = true;
+    }
+
+    respWriteUnlock(sess);
+
+    return rv;
+}
+
+
+
+static void publish(struct game_session *sess);
+
+
+
+/*makes the computer's move claimed by claimMove() and, with queue
+  set, queues its response, then hands the session back to its reader.
+  Returns what computer_move() did, any error is also left in move_err*/
+static int computerTurn(struct game_session *sess, bool queue)
+{
+    int rv = computer_move(sess);
+
+    //queued before thinking clears, a woken reader must find it there
+    respWriteLock(sess);
+
+    if (rv >= 0 && queue){
+        pushResponse(sess);
+    }
+
+    sess->move_err = min(rv, 0);
+    sess->thinking = false;
+    respWriteUnlock(sess);
+
+    publish(sess);
+
+    wake_up_interruptible(&sess->wait);
+
+    return rv;
+}
+
+
+
+//move_work: the computer's move queued by "03"
+static void moveWork(struct work_struct *work)
+{
+    struct game_session *sess = container_of(work, struct game_session, move_work);
 
+    computerTurn(sess, true);
 }
 
 
 
 
 
-static void print(void)
+//board is a copy of the position, taken without board_lock
+static void print(struct game_session *sess, u8 board[8][8])
 {
     int i, j;
-    char *itr = boardstr;
+    char *itr = sess->boardstr;
 
     /*iterate the board and copy each piece 
       into boardstr*/
@@ -930,50 +1271,122 @@ static void print(void)
     for (i = 0; i < 8; i++){
         for (j = 0; j < 8; j++){
 
-            char *piece = board[i][j];
-            memcpy(itr, piece, 2);
+            //translate the piece byte to the two char wire format
+            u8 piece = board[i][j];
+            itr[0] = color_chars[PIECE_COLOR(piece) >> 3];
+            itr[1] = type_chars[PIECE_TYPE(piece)];
 
             itr += 2;
 
         }
     }
 
-    boardstr[128] = '\n';    
+    sess->boardstr[128] = '\n';    
 
 }
 
 
 
-/*checks if a move made by the user is legal*/
+/*checks if a human move is legal and makes it. from and to are square
+  indexes and promoted_type is what a pawn promotes to, EMPTY if it
+  doesn't. A capture is a move onto an opponent's piece.
+
+  The move has to be one the engine's generator produces for the human,
+  so the rules are the computer's, with one exception the protocol has
+  always allowed: a pawn reaching the last rank may stay a pawn.
+
+  Unless piece is EMPTY, piece and dest are what a text move named on
+  from and to, and have to be what is there*/
 
-static bool validateMove(char *cmd, size_t len)
+static int playMove(struct game_session *sess, int from, int to, u8 promoted_type, u8 piece, u8 dest)
 {   
     
-    int i0 = 0, j0 = 0, i1 = 0, j1 = 0, i = 0, j = 0;
+    u16 moves[MAX_MOVES];
+    u8 moved;
+    int n, k;
+
+    //validation and the move itself are one change, no one sees the board in between
+    boardWriteLock(sess);
+
+    if (piece != EMPTY && (pieceAt(&sess->pos, from) != piece || pieceAt(&sess->pos, to) != dest)){
+        n = 0;
+    }
+
+    else{
+        n = generateMoves(&sess->pos, sess->human, moves);
+    }
 
-    char *src = NULL;
-    char *dest = NULL;
+    for (k = 0; k < n; k++){
+        if (MOVE_FROM(moves[k]) == from && MOVE_TO(moves[k]) == to &&
+            (MOVE_PROMO(moves[k]) == promoted_type || promoted_type == EMPTY)){
+            goto mov;
+        }
+    }
 
-    char color = cmd[3];
-    char type = cmd[4];
+    boardWriteUnlock(sess);
 
-    char promoted_type = '\0';
+    respWriteLock(sess);
+    sess->response = ILLMOVE;
+    sess->resplen = 8;
+    respWriteUnlock(sess);
 
-    /*these are the source and destination pieces listed by the cmd string
-     they've been initialized to two chars statically rather than dynamically 
-     allocating memory to make things simpler */
+    return CHESS_ILLMOVE;
 
-    char spiece[] = "**";
-    char dpiece[] = "**";
 
-    bool captured = false;
-    bool promoted = false;
 
-    //not human's piece
-    if (color != human){
-        goto err;
+mov:
+    /*just change the piece type of the moved piece if its being promoted*/
+    moved = pieceAt(&sess->pos, from);
+
+    if (promoted_type != EMPTY){
+        moved = sess->human | promoted_type;
     }
     
+    setSquare(&sess->pos, to, moved);
+    setSquare(&sess->pos, from, EMPTY);
+    
+    sess->moves++;
+    sess->gen++;
+    sess->turn = sess->comp;
+    sess->pos.key ^= zobrist_side;
+
+    verifyKey(&sess->pos, sess->turn);
+
+    boardWriteUnlock(sess);
+
+
+    respWriteLock(sess);
+    sess->response = OK;
+    sess->resplen = 3;
+    respWriteUnlock(sess);
+
+
+    return CHESS_OK;
+    
+}
+
+
+/*checks the text form of a human move, "02 WPe2-e4[xBP][yWQ]", and
+  works out the pieces it names. Whether they are the ones on the board
+  is left to playMove(), under the same lock as the move itself*/
+
+static bool validateMove(struct game_session *sess, char *cmd, size_t len)
+{   
+    
+    int i0 = 0, j0 = 0, i1 = 0, j1 = 0;
+
+    u8 dest = EMPTY;
+
+    u8 color = wireColor(cmd[3]);
+    u8 type = wireType(cmd[4]);
+
+    u8 promoted_type = EMPTY;
+
+    /*this is the source piece listed by the cmd string, translated 
+      into a piece byte so it compares directly against the board*/
+
+    u8 spiece = color | type;
+    
     /*Note: j and i assignments are flipped bc 2d array is stores as an array of row arrays
       EX: b3 -> (1, 2) in the chess board. but board[1][2] actually yields (2, 1) square 
       in the actual board (because 2d array is stored as arrays of rows)
@@ -984,64 +1397,31 @@ static bool validateMove(char *cmd, size_t len)
     i0 = cmd[5] - 'a';
     j0 = cmd[6] - '1';
 
-    src = board[j0][i0];
-
     i1 = cmd[8] - 'a';
     j1 = cmd[9] - '1';
 
-    dest = board[j1][i1];
-
-    spiece[0] = cmd[3];
-    spiece[1] = cmd[4];
-    
-
-    /*check if the piece to be moved is actually in the specified square*/
-    
-    if (src[0] != spiece[0] || src[1] != spiece[1]){
-        goto err;
-    }
-    
-    /*
-    if (strcmp(spiece, src)){
-        printk("2\n");
-        goto err;
-    }
-    */
-
-    /*if its a simple move and destination square isn't empty*/
-    if (len == 11 && dest[0] != '*'){
-        goto err;
-    }
-
 
+    /*a simple move names nothing on the destination square, which
+      has to be empty, and neither does a promotion alone*/
     if (len >= 14){
                 
         //opponent piece is captured 
         //this may or may not happen for a string len of 14
         //this check definitiely happens for a string length of 17 (capture and pawn promotion)
         if (cmd[10] == 'x'){
-            
-            dpiece[0] = cmd[11];
-            dpiece[1] = cmd[12];
-
-            if (strcmp(dpiece, dest)){
-                goto err;
-            }
-
-            captured  = true;
-
+            dest = wireColor(cmd[11]) | wireType(cmd[12]);
         }
 
         /* or piece is being promoted only, then check if its a pawn
-          this ctrl statement is only accesed by a 14 char string*/
+          this ctrl statement is only accesed by a 14 char string.
+          The pawn is the human's once playMove() finds it on the board*/
         
         else {
-            if (type != PAWN || dest[0] != '*' || cmd[11] != human){
+            if (type != PAWN || wireColor(cmd[11]) != color){
                 goto err;
             }
 
-            promoted = true;
-            promoted_type = cmd[12];
+            promoted_type = wireType(cmd[12]);
 
         }
 
@@ -1051,299 +1431,726 @@ static bool validateMove(char *cmd, size_t len)
          is already done in the first "if" statement*/
 
         if (len == 17){
-            if (type != PAWN || cmd[14] != human){
+            if (type != PAWN || wireColor(cmd[14]) != color){
                 goto err;
             }
 
-            promoted = true;
-            promoted_type = cmd[15];
+            promoted_type = wireType(cmd[15]);
 
         }
     } 
 
-    /*now we check if the actual piece movement is valid and move if valid
-      for details regarding the arithmetic rules for each type of piece, 
-      please check the design document*/
+    return playMove(sess, SQ(j0, i0), SQ(j1, i1), promoted_type, spiece, dest) == CHESS_OK;
 
-    if (type == PAWN){
-        
-        /*if a piece is captured then check if the pawn moves one space forward diagonally*/
-        if (captured){
-            //j1 - j0 is positive (forward) for white
-            if (color == WHITE && ((j1 - j0 != 1) || (i1 - i0 != 1 && i1 - i0 != -1))){ 
-                goto err;
-            }
+err:
+    respWriteLock(sess);
+    sess->response = ILLMOVE;
+    sess->resplen = 8;
+    respWriteUnlock(sess);
 
-            //j0-j1 is positive (forward) for black
-            else if (color == BLACK && ((j0 - j1 != 1) || (i1 - i0 != 1 && i1 - i0 != -1))){
-                goto err;
-            } 
- 
-        }
+    return false;
 
-        //check if the pawn has reached the other side if promoted
-        if (promoted){
-            if (color == WHITE && j1 != 7){
-                goto err;
-            }
+}
 
-            else if (color == BLACK && j1 != 0){
-                goto err;
-            }
 
-        }
 
-        /*check for normal move, 1 step forward, pawn is neither promoted 
-          or captured*/
 
-        if (!promoted && !captured){
-            if (color == WHITE && (i1 != i0 || (j0 == 1 && j1 - j0 != 2 && j1 - j0 != 1) || (j0 != 1 && j1 - j0 != 1))){
-                goto err;
-            }
+//starts a new game with the human playing color, "00" or CHESS_IOC_NEW_GAME
+static void newGame(struct game_session *sess, u8 color)
+{
+    boardWriteLock(sess);
+    reset(sess, color);
+    boardWriteUnlock(sess);
+
+    respWriteLock(sess);
+    sess->response = OK;
+    sess->resplen = 3;
+    respWriteUnlock(sess);
+}
 
-            //black pawn travels one index down the y axis
-            else if (color == BLACK && (i1 != i0 || (j0 == 6 && j0 - j1 != 2 && j0 - j1 != 1) || (j0 != 6 && j0 - j1 != 1))){
-                goto err;
-            }
 
+
+//the result code of the response last set on sess, for the mmap() page
+static int responseCode(struct game_session *sess)
+{
+    //a single pointer, no need for resp_lock
+    char *resp = READ_ONCE(sess->response);
+    int code = CHESS_OK;
+
+    if (resp == UNKCMD){
+        code = CHESS_UNKCMD;
+    }
+
+    else if (resp == INVFMT){
+        code = CHESS_INVFMT;
+    }
+
+    else if (resp == CHECK){
+        code = CHESS_CHECK;
+    }
+
+    else if (resp == MATE){
+        code = CHESS_MATE;
+    }
+
+    else if (resp == ILLMOVE){
+        code = CHESS_ILLMOVE;
+    }
+
+    else if (resp == OOT){
+        code = CHESS_OOT;
+    }
+
+    else if (resp == NOGAME){
+        code = CHESS_NOGAME;
+    }
+
+    else if (resp == TIE){
+        code = CHESS_TIE;
+    }
+
+    return code;
+}
+
+
+
+/*copies the game into sess's mmap() page. Called once a command is
+  done with rather than on every change, so the page never shows a
+  half made move and the move path gains no more than one copy*/
+static void publish(struct game_session *sess)
+{
+    struct chess_state *st = sess->state;
+    int result = responseCode(sess);
+    unsigned int bseq;
+    u32 seq;
+
+    mutex_lock(&sess->state_lock);
+
+    seq = st->seq;
+    WRITE_ONCE(st->seq, seq + 1);
+    smp_wmb();
+
+    //the page's seq stays odd across any retries here
+    do {
+        bseq = read_seqcount_begin(&sess->board_seq);
+
+        memcpy(st->squares, sess->pos.board, sizeof(st->squares));
+        st->games = sess->games;
+        st->moves = sess->moves;
+        st->turn = sess->turn;
+        st->human = sess->human;
+        st->last_from = MOVE_FROM(sess->last_move);
+        st->last_to = MOVE_TO(sess->last_move);
+        st->last_promo = MOVE_PROMO(sess->last_move);
+
+    } while (read_seqcount_retry(&sess->board_seq, bseq));
+
+    st->thinking = READ_ONCE(sess->thinking);
+    st->result = result;
+
+    smp_wmb();
+    WRITE_ONCE(st->seq, seq + 2);
+
+    mutex_unlock(&sess->state_lock);
+}
+
+
+static int game_open(struct inode *pinode, struct file *pfile)
+{
+    struct game_session *sess = NULL;
+
+    sess = kmem_cache_zalloc(session_cache, GFP_KERNEL);
+
+    if (sess == NULL){
+        return -ENOMEM;
+    }
+
+    sess->state = (struct chess_state *) get_zeroed_page(GFP_KERNEL);
+    sess->ring = kmalloc(RING_SIZE, GFP_KERNEL);
+    sess->batch = kmalloc(BATCH_MAX, GFP_KERNEL);
+    sess->perft_out = kmalloc(PERFT_OUT, GFP_KERNEL);
+
+    if (sess->state == NULL || sess->ring == NULL || sess->batch == NULL || sess->perft_out == NULL){
+        kfree(sess->perft_out);
+        kfree(sess->batch);
+        kfree(sess->ring);
+        free_page((unsigned long) sess->state);
+        kmem_cache_free(session_cache, sess);
+        return -ENOMEM;
+    }
+
+    atomic64_add(5, &stats.allocs);
+    atomic64_inc(&stats.sessions);
+
+    init_rwsem(&sess->board_lock);
+    init_rwsem(&sess->resp_lock);
+    seqcount_rwsem_init(&sess->board_seq, &sess->board_lock);
+    mutex_init(&sess->search_lock);
+    mutex_init(&sess->state_lock);
+    mutex_init(&sess->write_lock);
+    init_waitqueue_head(&sess->wait);
+    INIT_WORK(&sess->move_work, moveWork);
+
+    //no game has been started on this file yet
+    sess->response = NOGAME;
+    sess->resplen = 7;
+
+    memset(sess->pos.board, EMPTY, sizeof(sess->pos.board));
+    syncBitboards(&sess->pos);
+
+    publish(sess);
+
+    pfile->private_data = sess;
+
+    //responses are a stream, there is nothing to seek in
+    return nonseekable_open(pinode, pfile);
+
+}
+
+
+static int game_release(struct inode *pinode, struct file *pfile)
+{
+    struct game_session *sess = pfile->private_data;
+
+    //a computer move still being searched has to finish first
+    cancel_work_sync(&sess->move_work);
+
+    pfile->private_data = NULL;
+    kvfree(sess->search);
+    kfree(sess->batch);
+    kfree(sess->perft_out);
+    kfree(sess->ring);
+    free_page((unsigned long) sess->state);
+    kmem_cache_free(session_cache, sess);
+
+    return 0;
+
+}
+
+
+/*waits until no computer move is being searched on sess, or fails
+  with -EAGAIN for a non-blocking file*/
+static int waitMove(struct game_session *sess, struct file *pfile)
+{
+    if (!READ_ONCE(sess->thinking)){
+        return 0;
+    }
+
+    if (pfile->f_flags & O_NONBLOCK){
+        return -EAGAIN;
+    }
+
+    if (wait_event_interruptible(sess->wait, !READ_ONCE(sess->thinking))){
+        return -ERESTARTSYS;
+    }
+
+    return 0;
+}
+
+
+/*like waitMove(), and until the ring also has room for a response of
+  need bytes. A reader that falls behind holds up the writer instead of
+  having its responses dropped*/
+static int waitWrite(struct game_session *sess, struct file *pfile, size_t need)
+{
+    if (!READ_ONCE(sess->thinking) && ringRoom(sess, need)){
+        return 0;
+    }
+
+    if (pfile->f_flags & O_NONBLOCK){
+        return -EAGAIN;
+    }
+
+    if (wait_event_interruptible(sess->wait, !READ_ONCE(sess->thinking) && ringRoom(sess, need))){
+        return -ERESTARTSYS;
+    }
+
+    return 0;
+}
+
+
+static ssize_t game_read(struct file *pfile, char __user *usr, size_t len, loff_t *offset)
+{
+
+    struct game_session *sess = pfile->private_data;
+
+    ssize_t bytes_read = 0;
+    unsigned long uncopied = 0;
+    size_t off, n;
+    int err = 0;
+    
+    if (access_ok(usr, len) == EFAULT){
+        return -EFAULT;
+    }
+
+    //the response to "03" only exists once the computer has moved
+    err = waitMove(sess, pfile);
+
+    if (err){
+        return err;
+    }
+
+    err = xchg(&sess->move_err, 0);
+
+    if (err){
+        return err;
+    }
+
+
+    /*hand out as much of the queued responses as fits in len, at
+      most two copies since the ring can wrap. What is read is gone,
+      so with nothing queued this is end of file*/
+    respWriteLock(sess);
+
+    len = min(len, sess->tail - sess->head);
+
+    while (len > 0){
+        off = sess->head & (RING_SIZE - 1);
+        n = min(len, (size_t) (RING_SIZE - off));
+
+        uncopied = copy_to_user(usr + bytes_read, sess->ring + off, n);
+
+        sess->head += n - uncopied;
+        bytes_read += n - uncopied;
+        len -= n;
+
+        if (uncopied != 0){
+            break;
         }
+    }
+
+    respWriteUnlock(sess);
 
-        goto mov;
+    //a writer in waitWrite() may have room now
+    if (bytes_read > 0){
+        wake_up_interruptible(&sess->wait);
+    }
 
+    //a fault after some of it was copied is a short read
+    if (uncopied != 0 && bytes_read == 0){
+        return -EFAULT;
     }
 
+    *offset += bytes_read;
 
-    if (type == ROOK){
-         
-        //constraint for vertical/horizontal rook movement  
-        if (i0 != i1 && j0 != j1){
-            goto err;
+    return bytes_read;
+
+}
+
+
+/*"06 P<depth>[ <fen>]" counts perft nodes, "06 D..." also lists the
+  count below each root move, one "e2-e4 <nodes>" line per move. The last
+  line is "NODES <n> NS <elapsed> NPS <nodes per second>". The response
+  is queued here, while search_lock still keeps perft_out to itself*/
+static int perftCommand(struct game_session *sess, char *str, size_t len)
+{
+    char *resp = INVFMT;
+    size_t rlen = 7;
+    char *fen = NULL;
+    unsigned int depth = 0;
+    u64 nodes, ns;
+    size_t k;
+    int n, m;
+
+    //already checked to be digits, up to a space before the fen or the end
+    str[len - 1] = '\0';
+
+    for (k = 4; str[k] >= '0' && str[k] <= '9' && depth <= CHESS_PERFT_MAX_DEPTH; k++){
+        depth = depth * 10 + (str[k] - '0');
+    }
+
+    if (str[k] == ' '){
+        fen = str + k + 1;
+    }
+
+    if (depth < 1 || depth > CHESS_PERFT_MAX_DEPTH){
+        goto ret;
+    }
+
+    mutex_lock(&sess->search_lock);
+
+    n = perftRun(sess, fen, depth, &nodes, &ns);
+
+    if (n == -EINVAL){
+        mutex_unlock(&sess->search_lock);
+        goto ret;
+    }
+
+    if (n < 0){
+        mutex_unlock(&sess->search_lock);
+        return n;
+    }
+
+    resp = sess->perft_out;
+    rlen = 0;
+
+    for (m = 0; str[3] == 'D' && m < n; m++){
+        u16 move = sess->search->moves[0][m];
+
+        rlen += scnprintf(resp + rlen, PERFT_OUT - rlen, "%c%c-%c%c%.*s %llu\n",
+                          'a' + (MOVE_FROM(move) & 7), '1' + (MOVE_FROM(move) >> 3),
+                          'a' + (MOVE_TO(move) & 7), '1' + (MOVE_TO(move) >> 3),
+                          MOVE_PROMO(move) != EMPTY, &type_chars[MOVE_PROMO(move)],
+                          sess->search->divide[m]);
+    }
+
+    rlen += scnprintf(resp + rlen, PERFT_OUT - rlen, "NODES %llu NS %llu NPS %llu\n",
+                      nodes, ns, mul_u64_u64_div_u64(nodes, NSEC_PER_SEC, max(ns, 1ULL)));
+
+    //perft_out is copied into the ring before another perft can reuse it
+    respWriteLock(sess);
+    sess->response = resp;
+    sess->resplen = rlen;
+    pushResponse(sess);
+    respWriteUnlock(sess);
+
+    mutex_unlock(&sess->search_lock);
+
+    return 0;
+
+ret:
+    respWriteLock(sess);
+    sess->response = resp;
+    sess->resplen = rlen;
+    pushResponse(sess);
+    respWriteUnlock(sess);
+
+    return 0;
+}
+
+
+
+//the number after the limit letter of "03 N<nodes>" or "05 D<depth>", checked by validate()
+static u64 cmdValue(const char *str, size_t len)
+{
+    u64 value = 0;
+    size_t k;
+
+    for (k = 4; k < len - 1; k++){
+        value = value * 10 + (str[k] - '0');
+    }
+
+    return value;
+}
+
+
+
+/*runs one command of len bytes. With sync set a computer move is made
+  before returning rather than queued on move_wq. Returns 0 or -errno,
+  the outcome of the command itself is left in the response and queued
+  for read()*/
+static int runCommand(struct game_session *sess, char *str, size_t len, bool sync)
+{
+    char cmd = '\0';
+    int err = 0;
+
+    if(!validate(sess, str, len)){
+        queueResponse(sess);
+        return 0;
+    }
+
+
+    cmd = str[1];
+
+    //initializes a new game/resets game
+
+    if(cmd == '0'){
+        newGame(sess, wireColor(str[3]));
+    }
+
+
+    //returns board string
+    if (cmd == '1'){
+
+        u8 board[8][8];
+        int games;
+        unsigned int seq;
+
+        /*the board is copied out locklessly, so only the
+          response string needs a lock*/
+        do {
+            seq = read_seqcount_begin(&sess->board_seq);
+            games = sess->games;
+            memcpy(board, sess->pos.board, sizeof(board));
+        } while (read_seqcount_retry(&sess->board_seq, seq));
+
+        respWriteLock(sess);
+
+        if (games == 0){
+            sess->response = NOGAME;
+            sess->resplen = 7;
         }
-    
-        if (!blocked(j0, j1, i0, i1)){
-            goto mov;
+
+        else{
+            print(sess, board);
+            sess->response = sess->boardstr;
+            sess->resplen = 129;
         }
+    
+        respWriteUnlock(sess);
+
+    }
+
+
+    //human moves
+    if (cmd == '2'){
 
-        else{
-            goto err;
+        if (myTurn(sess, sess->human) == CHESS_OK && validateMove(sess, str, len)){
+            check_or_mate(sess, sess->comp);
         }
-
+        
     }
 
-    if (type == KNIGHT){
-        int product = (i1 - i0) * (j1 - j0);
 
-        if (product != 2 && product != -2){
-            goto err;
-        }
+    /*computer moves. The search runs on move_wq, the response is
+      there for the next read once it is done, unless sync is set*/
+    if (cmd == '3'){
 
-        goto mov;
+        if (myTurn(sess, sess->comp) == CHESS_OK){
 
-    }
+            //another writer on this file got its "03" in first
+            err = claimMove(sess);
 
-    if (type == BISHOP){
-        int slope = 0;
-        
-        /*this just makes sure that we don't divide by zero
-          since its behavior is undefined*/
-        if (j0 == j1){
-            goto err;
-        }
+            if (err){
+                return err;
+            }
 
-        slope = (i1 - i0) / (j1 - j0);
+            //a budget for this move only, computer_move() uses it up
+            if (len > 3 && str[3] == 'N'){
+                sess->move_nodes = cmdValue(str, len);
+            }
 
-        if (slope != 1 && slope != -1){
-            goto err;
-        } 
-        
+            else if (len > 3){
+                sess->move_ms = (unsigned int) min_t(u64, cmdValue(str, len), UINT_MAX);
+            }
 
-        if (!blocked(j0, j1, i0, i1)){
-            goto mov;
-        }
+            //a batch needs the move made before its next command
+            if (sync){
+                computerTurn(sess, true);
+                return xchg(&sess->move_err, 0);
+            }
 
-        else{
-            goto err;
+            queue_work(move_wq, &sess->move_work);
+
+            return 0;
         }
 
     }
 
 
-    if (type == QUEEN){
-        int slope = 0;
+    //resigns game
+    if (cmd == '4'){
+
+        char *resp = OK;
+        size_t rlen = 3;
 
-        //again, this avoids dividing by 0
-        if (j0 != j1){
-            slope = (i1 - i0) / (j1 - j0);
-        }
+        //ending the game is a change to the board like any other
+        boardWriteLock(sess);
         
-        /*checks if path matches either the rook or bishop movement patterns
-          since a queen is basically a rook and bishop powers combined together*/
-
-        if (i0 != i1 && j0 != j1 && slope != 1 && slope != -1){
-            goto err;
+        /*if game has already ended in Mate, simply return;
+          the project says resign command should return MATE 
+          as the response string if the game has already ended
+          in a mate*/
+        if (sess->mated){
+            resp = MATE;
+            rlen = 5;
         }
 
-
-        if (blocked(j0, j1, i0, i1)){
-            goto err;
+        else if (!sess->game_initialized){
+            resp = NOGAME;
+            rlen = 7;
         }
 
+        else if (sess->turn != sess->human){
+            resp = OOT;
+            rlen = 4;
+        }
 
         else{
-            goto mov;
+            sess->game_initialized = false;
         }
 
+        boardWriteUnlock(sess);
+        
+        respWriteLock(sess);
+        sess->response = resp;
+        sess->resplen = rlen;
+        respWriteUnlock(sess);
+
     }
 
-    if (type == KING){
 
-        //difference between the x coordinates and y coordinates
-        int di = i1 - i0;
-        int dj = j1 - j0;
+    //sets this session's search depth, node budget or time budget
+    if (cmd == '5'){
 
-        if (i0 == i1 || j0 == j1){
-            //if its a vertical or horizontal move, only square difference allowed
+        u64 value = cmdValue(str, len);
 
-            if (di != 1 && dj != 1 && di != -1 && dj != -1){
-                goto err;
-            }
+        //a depth beyond the search's ply limit is rejected
+        if (str[3] == 'D' && value > MAX_DEPTH){
 
-        }
+            respWriteLock(sess);
+            sess->response = INVFMT;
+            sess->resplen = 7;
+            pushResponse(sess);
+            respWriteUnlock(sess);
 
-        //these check if the move is a diagonal move
-        else if ((di * dj != 1) && (di * dj != -1)){
-            goto err;
-        }
+            return 0;
 
-        goto mov;   
+        }
 
-    }
+        boardWriteLock(sess);
 
-err:
-    down_write(&resp_lock);
-    response = ILLMOVE;
-    resplen = 8;
-    up_write(&resp_lock);
+        if (str[3] == 'D'){
+            sess->depth_limit = (unsigned int) value;
+        }
 
-    return false;
+        else if (str[3] == 'N'){
+            sess->node_limit = value;
+        }
 
+        else{
+            sess->time_limit = (unsigned int) min_t(u64, value, UINT_MAX);
+        }
 
+        boardWriteUnlock(sess);
 
-mov:
-    /*just change the piece type of the moved piece if its being promoted*/
-    down_write(&board_lock);
+        respWriteLock(sess);
+        sess->response = OK;
+        sess->resplen = 3;
+        respWriteUnlock(sess);
 
-    if (color == WHITE){
-        i = wkingpos[0];
-        j = wkingpos[1];
     }
 
-    else{
-        i = bkingpos[0];
-        j = bkingpos[1];
-    }
 
-    if (promoted){
-        src = (char *) kmalloc (2, GFP_KERNEL);
-        promoted_pieces[index] = src;
-        index++;
-        src[0] = color;
-        src[1] = promoted_type;
+    //perft from the starting position or a FEN, which queues its own response
+    if (cmd == '6'){
+        return perftCommand(sess, str, len);
     }
-    
-    board[j1][i1] = src;
-    board[j0][i0] = EMPTY;
 
-    moves++;
 
-    up_write(&board_lock);
+    /*a computer move queues its own response once made, and has
+      returned by now. Every other command is done with*/
+    queueResponse(sess);
 
-    /*we're acquiring a read lock in order to call check()
-      and see if the move the playing side is making puts the 
-      king in check. If it does, we call a write lock for the 
-      board again to reverse the move we made and goto err to 
-      return ILLMOVE error*/
+    return 0;
 
-    if (check(i, j, color)){
+}
 
-        down_write(&board_lock);
 
-        board[j1][i1] = dest;
-        board[j0][i0] = src;
 
-        up_write(&board_lock);
+/*runs a write() of several newline separated commands one after the
+  other, each queueing its response so one read() can return them all.
+  Only the first command waits for room in the ring. Returns how much of
+  the write was used: it stops short when the write is longer than
+  BATCH_MAX or the ring has no room for the next command's response,
+  and the caller writes the rest again. A writer that queues more than
+  the ring holds has to read() before it does, or it waits for good*/
+static ssize_t runBatch(struct game_session *sess, struct file *pfile, const char __user *usr, size_t len)
+{
+    size_t n = min(len, (size_t) BATCH_MAX);
+    size_t pos = 0;
+    char *in = sess->batch;
+    int err = 0;
 
-        goto err;
-        
+    if (copy_from_user(in, usr, n)){
+        return -EFAULT;
     }
 
-    
+    //no command in it at all, so it is one malformed command
+    if (memchr(in, '\n', n) == NULL){
+        err = waitWrite(sess, pfile, RESP_MAX);
 
-    down_write(&board_lock);
-    
-    if (type == KING){
-        if (color == WHITE){
-            wkingpos[0] = j1;
-            wkingpos[1] = i1;
+        if (err){
+            return err;
         }
 
-        else{
-            bkingpos[0] = j1;
-            bkingpos[1] = i1;
-        }
+        atomic64_inc(&stats.commands);
+
+        respWriteLock(sess);
+        sess->response = INVFMT;
+        sess->resplen = 7;
+        pushResponse(sess);
+        respWriteUnlock(sess);
+
+        return len;
     }
-    
-    turn = comp;
 
-    up_write(&board_lock);
+    while (pos < n){
+        char *nl = memchr(in + pos, '\n', n - pos);
+        size_t cmdlen;
+
+        if (nl != NULL){
+            cmdlen = nl - (in + pos) + 1;
+        }
 
+        //an unterminated last command is run as it is, unless BATCH_MAX cut it off
+        else if (n == len){
+            cmdlen = n - pos;
+        }
 
-    down_write(&resp_lock);
-    response = OK;
-    resplen = 3;
-    up_write(&resp_lock);
+        else{
+            break;
+        }
 
+        //the first command waits for room, the rest stop the batch short
+        if (pos == 0){
+            err = waitWrite(sess, pfile, responseRoom(in, cmdlen));
 
-    return true;
-    
-}
+            if (err){
+                return err;
+            }
+        }
 
+        else if (!ringRoom(sess, responseRoom(in + pos, cmdlen))){
+            break;
+        }
 
-static ssize_t game_read(struct file *pfile, char __user *usr, size_t len, loff_t *offset)
-{
+        atomic64_inc(&stats.commands);
 
-    ssize_t bytes_read = 0;
-    unsigned long uncopied = 0;
-    
-    if (access_ok(usr, len) == EFAULT){
-        return -EFAULT;
-    }
+        if (cmdlen <= 2){
+            respWriteLock(sess);
+            sess->response = UNKCMD;
+            sess->resplen = 7;
+            pushResponse(sess);
+            respWriteUnlock(sess);
+        }
 
+        else if (cmdlen > CMD_MAX){
+            respWriteLock(sess);
+            sess->response = INVFMT;
+            sess->resplen = 7;
+            pushResponse(sess);
+            respWriteUnlock(sess);
+        }
 
-    //allocate command buffer and copy from user  
-    down_read(&resp_lock);
-   
-    uncopied = copy_to_user(usr, response, resplen);    
-    bytes_read = (ssize_t) resplen;
+        else{
+            err = runCommand(sess, in + pos, cmdlen, true);
 
-    up_read(&resp_lock);
+            if (err){
+                break;
+            }
+        }
 
-    if (uncopied != 0){
-        return -EFAULT;
+        pos += cmdlen;
     }
 
+    //an error only fails the write if no command got through
+    if (pos == 0 && err){
+        return err;
+    }
 
-    return bytes_read;
-
+    return pos;
 }
 
 
-static ssize_t game_write(struct file *pfile, const char __user *usr, size_t len, loff_t *offset)
+
+static ssize_t writeCommands(struct game_session *sess, struct file *pfile, const char __user *usr, size_t len)
 {   
-    
-    char *str = NULL;
-    char cmd = '\0';
+
+    //command buffer, on the stack since a command is at most CMD_MAX bytes
+    char str[CMD_MAX];
     unsigned long uncopied = 0;
+    int err = 0;
     
     if (access_ok(usr, len) == EFAULT){
         return -EFAULT;
@@ -1351,279 +2158,476 @@ static ssize_t game_write(struct file *pfile, const char __user *usr, size_t len
 
     //length of string must be at least three, including '\n', to be valid cmd
     if (len <= 2){
+        err = waitWrite(sess, pfile, RESP_MAX);
 
-        down_write(&resp_lock);
-        response = UNKCMD;
-        resplen = 7;
-        up_write(&resp_lock);
+        if (err){
+            return err;
+        }
+
+        respWriteLock(sess);
+        sess->response = UNKCMD;
+        sess->resplen = 7;
+        pushResponse(sess);
+        respWriteUnlock(sess);
         
         return len;   
          
     }
 
-    
-    //allocate command buffer and copy from user    
-    str = (char *) kmalloc(len, GFP_KERNEL);
-
-    if (str == NULL){
-        //kfree(str);
-        return -ENOMEM;
+    //too long for one command, so either a batch of them or malformed
+    if (len > CMD_MAX){
+        return runBatch(sess, pfile, usr, len);
     }
 
+    
+    //copy command from user    
     uncopied = copy_from_user(str, usr, len);
 
-    //free and return error if something goes wrong
+    //return error if something goes wrong
     if (uncopied != 0){
-        kfree(str);
         return -EFAULT;
     }
 
+    //a newline before the end means more than one command
+    if (memchr(str, '\n', len - 1) != NULL){
+        return runBatch(sess, pfile, usr, len);
+    }
 
-    if(!validate(str, len)){
-        kfree(str);
-        return len;
+    /*one command at a time, a new one waits for the computer's move and
+      for a reader to leave room for its response*/
+    err = waitWrite(sess, pfile, responseRoom(str, len));
+
+    if (err){
+        return err;
     }
 
+    atomic64_inc(&stats.commands);
 
-    cmd = str[1];
+    err = runCommand(sess, str, len, false);
 
-    //initializes a new game/resets game
+    return err ? err : (ssize_t) len;
 
-    if(cmd == '0'){
-        
-        down_write(&board_lock);
-        reset(str[3]);
-        up_write(&board_lock);
+}
 
-        down_write(&resp_lock);
-        response = OK;
-        resplen = 3;
-        up_write(&resp_lock);
 
+/*a computer move for the ioctls, searched right here rather than on
+  move_wq since the caller wants the move back, on a budget of nodes
+  nodes and ms milliseconds, 0 for the session's own. Returns the
+  move's result code with the move in last_move, or -errno*/
+static int ioctlMove(struct game_session *sess, u64 nodes, unsigned int ms)
+{
+    int rv = claimMove(sess);
+
+    if (rv){
+        return rv;
     }
 
+    sess->move_nodes = nodes;
+    sess->move_ms = ms;
 
-    //returns board string
-    if (cmd == '1'){
-        /*this is the one exception we are using board_lock
-         for the response variable because it involves the board string
-         not a response string
-        */
+    rv = computerTurn(sess, false);
 
-        
-        down_read(&board_lock);
-        down_write(&resp_lock);
+    //the error goes back here, not to the next read()
+    xchg(&sess->move_err, 0);
 
-        if (games == 0){
-            response = NOGAME;
-            resplen = 7;
+    return rv;
+}
+
+
+
+/*the binary protocol, see chess_ioctl.h. Each call does the same as its
+  text command, but its result only goes back in the struct: nothing is
+  queued for read()*/
+static long ioctlCommand(struct game_session *sess, struct file *pfile, unsigned int cmd, unsigned long arg)
+{
+    void __user *uarg = (void __user *) arg;
+
+    struct chess_new_game game;
+    struct chess_move move;
+    struct chess_search search, budget;
+    struct chess_board board;
+    struct chess_perft perft;
+    struct chess_perft_move __user *umoves;
+    struct chess_perft_move pm;
+
+    unsigned int k;
+    unsigned int seq;
+    u16 last;
+    int err = 0;
+
+    if (cmd == CHESS_IOC_VERSION){
+        return put_user(CHESS_ABI_VERSION, (__u32 __user *) uarg);
+    }
+
+    //same ordering as write(), wait for a computer move in progress
+    err = waitMove(sess, pfile);
+
+    if (err){
+        return err;
+    }
+
+    atomic64_inc(&stats.commands);
+
+    switch (cmd){
+
+    case CHESS_IOC_NEW_GAME:
+
+        if (copy_from_user(&game, uarg, sizeof(game))){
+            return -EFAULT;
+        }
+
+        if (game.color != WHITE && game.color != BLACK){
+            game.result = CHESS_INVFMT;
         }
 
         else{
-            print();
-            response = boardstr;
-            resplen = 129;
+            newGame(sess, game.color);
+            game.result = CHESS_OK;
         }
-    
-        up_write(&resp_lock);
-        up_read(&board_lock);
 
-    }
+        return copy_to_user(uarg, &game, sizeof(game)) ? -EFAULT : 0;
 
 
-    //human moves
-    if (cmd == '2'){
+    case CHESS_IOC_MOVE:
 
-        int i = 0, j = 0;
-        
-        down_read(&board_lock);
-        
-        if (!game_initialized){
+        if (copy_from_user(&move, uarg, sizeof(move))){
+            return -EFAULT;
+        }
 
-            down_write(&resp_lock);
-            response = NOGAME;
-            resplen = 7;
-            up_write(&resp_lock);
+        if (move.from > 63 || move.to > 63 || move.promo > KING){
+            move.result = CHESS_INVFMT;
+        }
 
-            up_read(&board_lock);
+        //the result is each step's own, sess->response is another writer's to change
+        else{
+            move.result = myTurn(sess, sess->human);
 
-            kfree(str);
-            return len;
+            if (move.result == CHESS_OK){
+                move.result = playMove(sess, move.from, move.to, move.promo, EMPTY, EMPTY);
+            }
 
+            if (move.result == CHESS_OK){
+                move.result = check_or_mate(sess, sess->comp);
+            }
         }
 
+        return copy_to_user(uarg, &move, sizeof(move)) ? -EFAULT : 0;
 
-        if (turn != human){
 
-            down_write(&resp_lock);
-            response = OOT;
-            resplen = 4;
-            up_write(&resp_lock);
+    case CHESS_IOC_COMPUTER_MOVE:
 
-            up_read(&board_lock);
-            
-            kfree(str);
-            return len;
+        memset(&move, 0, sizeof(move));
 
+        move.result = myTurn(sess, sess->comp);
+
+        if (move.result == CHESS_OK){
+
+            move.result = ioctlMove(sess, 0, 0);
+
+            if (move.result < 0){
+                return move.result;
+            }
+
+            last = READ_ONCE(sess->last_move);
+
+            if (last != MOVE_NONE){
+                move.from = MOVE_FROM(last);
+                move.to = MOVE_TO(last);
+                move.promo = MOVE_PROMO(last);
+            }
         }
 
+        return copy_to_user(uarg, &move, sizeof(move)) ? -EFAULT : 0;
+
 
-        if (human == WHITE){
-            i = bkingpos[0];
-            j = bkingpos[1];
+    case CHESS_IOC_SEARCH:
+
+        if (copy_from_user(&budget, uarg, sizeof(budget))){
+            return -EFAULT;
         }
 
-        else{
-            i = wkingpos[0];
-            j = wkingpos[1]; 
+        memset(&search, 0, sizeof(search));
+        search.ms = budget.ms;
+        search.node_limit = budget.node_limit;
+
+        search.result = myTurn(sess, sess->comp);
+
+        if (search.result == CHESS_OK){
+
+            search.result = ioctlMove(sess, search.node_limit, search.ms);
+
+            if (search.result < 0){
+                return search.result;
+            }
+
+            last = READ_ONCE(sess->last_move);
+
+            search.from = MOVE_FROM(last);
+            search.to = MOVE_TO(last);
+            search.promo = MOVE_PROMO(last);
+            search.depth = (__u8) READ_ONCE(sess->last_depth);
+            search.nodes = READ_ONCE(sess->last_nodes);
+            search.ns = READ_ONCE(sess->last_ns);
         }
-        
-        /*
-        printk("i is: %d\n", i);
-        printk("j is: %d\n", j);
-        */
 
-        up_read(&board_lock);
+        return copy_to_user(uarg, &search, sizeof(search)) ? -EFAULT : 0;
 
-        validateMove(str, len);
-        check_or_mate(i, j, comp);
-        
-    }
 
+    case CHESS_IOC_BOARD:
 
-    //computer moves
-    if (cmd == '3'){
+        memset(&board, 0, sizeof(board));
+
+        do {
+            seq = read_seqcount_begin(&sess->board_seq);
 
-        int i = 0, j = 0;
+            if (sess->games == 0){
+                board.result = CHESS_NOGAME;
+            }
 
-        down_read(&board_lock);
+            else{
+                memcpy(board.squares, sess->pos.board, sizeof(board.squares));
+                board.turn = sess->turn;
+                board.result = CHESS_OK;
+            }
 
-        if (!game_initialized){
+        } while (read_seqcount_retry(&sess->board_seq, seq));
 
-            down_write(&resp_lock);
-            response = NOGAME;
-            resplen = 7;
-            up_write(&resp_lock);
+        return copy_to_user(uarg, &board, sizeof(board)) ? -EFAULT : 0;
 
-            up_read(&board_lock);
 
-            kfree(str);
-            return len;
+    //the root split is copied straight out of the search context, one move at a time
+    case CHESS_IOC_PERFT:
 
+        if (copy_from_user(&perft, uarg, sizeof(perft))){
+            return -EFAULT;
         }
 
-        if (turn != comp){
+        perft.fen[CHESS_FEN_MAX - 1] = '\0';
+        umoves = u64_to_user_ptr(perft.moves);
 
-            down_write(&resp_lock);
-            response = OOT;
-            resplen = 4;
-            up_write(&resp_lock);
+        if (perft.depth < 1 || perft.depth > CHESS_PERFT_MAX_DEPTH){
+            perft.result = CHESS_INVFMT;
+            return copy_to_user(uarg, &perft, sizeof(perft)) ? -EFAULT : 0;
+        }
 
-            up_read(&board_lock);
+        mutex_lock(&sess->search_lock);
 
-            kfree(str);
-            return len;
+        err = perftRun(sess, perft.fen[0] ? perft.fen : NULL, perft.depth, &perft.nodes, &perft.ns);
 
+        if (err == -EINVAL){
+            perft.result = CHESS_INVFMT;
+            err = 0;
         }
 
+        else if (err >= 0){
+            perft.result = CHESS_OK;
+            perft.nps = mul_u64_u64_div_u64(perft.nodes, NSEC_PER_SEC, max(perft.ns, 1ULL));
+            perft.nmoves = (umoves == NULL) ? 0 : min(perft.nmoves, (__u32) err);
+
+            for (k = 0; k < perft.nmoves; k++){
+                u16 move = sess->search->moves[0][k];
+
+                memset(&pm, 0, sizeof(pm));
+                pm.from = MOVE_FROM(move);
+                pm.to = MOVE_TO(move);
+                pm.promo = MOVE_PROMO(move);
+                pm.nodes = sess->search->divide[k];
 
-        if (comp == WHITE){
-            i = bkingpos[0];
-            j = bkingpos[1];
+                if (copy_to_user(&umoves[k], &pm, sizeof(pm))){
+                    break;
+                }
+            }
+
+            err = (k < perft.nmoves) ? -EFAULT : 0;
         }
 
-        else{
-            i = wkingpos[0];
-            j = wkingpos[1]; 
+        mutex_unlock(&sess->search_lock);
+
+        if (err){
+            return err;
         }
 
-        up_read(&board_lock);
+        return copy_to_user(uarg, &perft, sizeof(perft)) ? -EFAULT : 0;
+
 
-        computer_move();
-        check_or_mate(i, j, human);
+    default:
+        return -ENOTTY;
 
     }
+}
 
 
-    //resigns game
-    if (cmd == '4'){
+static ssize_t game_write(struct file *pfile, const char __user *usr, size_t len, loff_t *offset)
+{
+    struct game_session *sess = pfile->private_data;
+    ssize_t rv;
 
-        down_read(&board_lock);
-        
-        /*if game has already ended in Mate, simply return;
-          the project says resign command should return MATE 
-          as the response string if the game has already ended
-          in a mate*/
-          
-        down_read(&resp_lock);
+    //writers sharing the file take turns, see write_lock
+    if (mutex_lock_interruptible(&sess->write_lock)){
+        return -ERESTARTSYS;
+    }
 
-        if (mated){
-            response = MATE;
-            resplen = 5;
+    rv = writeCommands(sess, pfile, usr, len);
 
-            up_read(&resp_lock);
-            up_read(&board_lock);
+    mutex_unlock(&sess->write_lock);
 
-            kfree(str);
-            return len;
+    publish(sess);
+
+    return rv;
+}
 
-        }
 
-        up_read(&resp_lock);
 
+static long game_ioctl(struct file *pfile, unsigned int cmd, unsigned long arg)
+{
+    struct game_session *sess = pfile->private_data;
+    long rv = ioctlCommand(sess, pfile, cmd, arg);
 
-        if (!game_initialized){
+    //none of these change anything, and readers should not queue on state_lock
+    if (cmd != CHESS_IOC_VERSION && cmd != CHESS_IOC_BOARD && cmd != CHESS_IOC_PERFT){
+        publish(sess);
+    }
 
-            down_write(&resp_lock);
-            response = NOGAME;
-            resplen = 7;
-            up_write(&resp_lock);
+    return rv;
+}
 
-            up_read(&board_lock);
 
-            kfree(str);
-            return len;
 
-        }
+/*maps the session's state page read only. The mapping holds a
+  reference on the file, so the page outlives it and release() can
+  free it unconditionally*/
+static int game_mmap(struct file *pfile, struct vm_area_struct *vma)
+{
+    struct game_session *sess = pfile->private_data;
 
-        if (turn != human){
+    if (vma->vm_pgoff != 0 || vma->vm_end - vma->vm_start != PAGE_SIZE){
+        return -EINVAL;
+    }
 
-            down_write(&resp_lock);
-            response = OOT;
-            resplen = 4;
-            up_write(&resp_lock);
+    //no writable mapping, and no mprotect() to one later
+    if (vma->vm_flags & VM_WRITE){
+        return -EPERM;
+    }
 
-            up_read(&board_lock);
-            
-            kfree(str);
-            return len;
+    vm_flags_clear(vma, VM_MAYWRITE);
 
-        }
+    return vm_insert_page(vma, vma->vm_start, virt_to_page(sess->state));
+}
 
-        game_initialized = false;
-        
-        down_write(&resp_lock);
-        response = OK;
-        resplen = 3;
-        up_write(&resp_lock);
 
-        up_read(&board_lock);
+/*nothing while a computer move is being searched. Otherwise readable
+  if a response is queued and writable if the ring has room for another.
+  pushResponse(), game_read() and computerTurn() wake the poller*/
+static __poll_t game_poll(struct file *pfile, struct poll_table_struct *wait)
+{
+    struct game_session *sess = pfile->private_data;
+    __poll_t mask = 0;
 
-    } 
+    poll_wait(pfile, &sess->wait, wait);
 
+    if (READ_ONCE(sess->thinking)){
+        return 0;
+    }
 
-    kfree(str);
-    return len;
+    if (READ_ONCE(sess->tail) != READ_ONCE(sess->head)){
+        mask |= EPOLLIN | EPOLLRDNORM;
+    }
+
+    //writable for any command but a perft, which can still wait or get -EAGAIN
+    if (ringRoom(sess, RESP_MAX)){
+        mask |= EPOLLOUT | EPOLLWRNORM;
+    }
 
+    return mask;
 }
 
 
 static struct file_operations gamefops = {
     .owner = THIS_MODULE,
+    .open = game_open,
+    .release = game_release,
     .read = game_read,
     .write = game_write,
+    .poll = game_poll,
+    .mmap = game_mmap,
+    .unlocked_ioctl = game_ioctl,
+    .compat_ioctl = compat_ptr_ioctl,
+};
+
+
+/*transposition table occupancy in permille, sampled from the first
+  buckets rather than walking the whole table*/
+static unsigned int ttOccupancy(void)
+{
+    unsigned long buckets = min(tt_mask + 1, 250UL);
+    unsigned long used = 0;
+    unsigned long b;
+    int k;
+
+    for (b = 0; b < buckets; b++){
+        for (k = 0; k < TT_BUCKET; k++){
+            if (READ_ONCE(tt[b].entries[k].data) != 0){
+                used++;
+            }
+        }
+    }
+
+    return (unsigned int) (used * 1000 / (buckets * TT_BUCKET));
+}
+
+
+//percentage of beta cutoffs the first move searched gave, how well moves are ordered
+static unsigned int firstCutoffPct(void)
+{
+    s64 cutoffs = atomic64_read(&stats.cutoffs);
+
+    if (cutoffs == 0){
+        return 0;
+    }
+
+    return (unsigned int) div64_s64(atomic64_read(&stats.first_cutoffs) * 100, cutoffs);
+}
+
+
+static ssize_t stats_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    ssize_t len;
+
+    //keeps a resize from freeing the table while it is sampled
+    down_read(&tt_lock);
+
+    len = sysfs_emit(buf, "sessions %lld\ncommands %lld\nallocs %lld\nnodes %lld\nqnodes %lld\nsearch_us %lld\n"
+                     "tt_mb %u\ntt_probes %lld\ntt_hits %lld\ntt_collisions %lld\ntt_occupancy %u\n"
+                     "cutoffs %lld\nfirst_cutoffs %lld\nfirst_cutoff_pct %u\n",
+                     atomic64_read(&stats.sessions),
+                     atomic64_read(&stats.commands),
+                     atomic64_read(&stats.allocs),
+                     atomic64_read(&stats.nodes),
+                     atomic64_read(&stats.qnodes),
+                     div_s64(atomic64_read(&stats.search_ns), 1000),
+                     tt_mb,
+                     atomic64_read(&stats.tt_probes),
+                     atomic64_read(&stats.tt_hits),
+                     atomic64_read(&stats.tt_collisions),
+                     ttOccupancy(),
+                     atomic64_read(&stats.cutoffs),
+                     atomic64_read(&stats.first_cutoffs),
+                     firstCutoffPct());
+
+    up_read(&tt_lock);
+
+    return len;
+}
+
+static DEVICE_ATTR_RO(stats);
+
+static struct attribute *chess_attrs[] = {
+    &dev_attr_stats.attr,
+    NULL,
 };
 
+ATTRIBUTE_GROUPS(chess);
+
 
 static struct miscdevice game = {
     //dynamically choose a minor number
@@ -1636,48 +2640,85 @@ static struct miscdevice game = {
 
     //0666 gives read/write access to the user (owner), group, and others that have access to the file
     .mode = 0666,
+
+    //exposes /sys/class/misc/chess/stats
+    .groups = chess_groups,
 };
 
 
 static int __init game_init(void)
 {
-    int i;
-    int rv = misc_register(&game);
+    int rv = 0;
+
+    //the ABI exposes piece bytes as they are
+    BUILD_BUG_ON(WHITE != CHESS_WHITE || BLACK != CHESS_BLACK);
+    BUILD_BUG_ON(PAWN != CHESS_PAWN || KING != CHESS_KING);
+    BUILD_BUG_ON(sizeof(struct chess_state) > PAGE_SIZE);
+    BUILD_BUG_ON(CHESS_PERFT_MAX_DEPTH >= MAX_PLY || PERFT_OUT > RING_SIZE);
+    BUILD_BUG_ON(MAX_DEPTH + QUIESCE_PLY >= MAX_PLY || MAX_DEPTH != CHESS_MAX_DEPTH);
 
+    rv = ttResize(tt_mb);
 
     if (rv){
-        printk("Device registration failed\n");
+        printk("Transposition table allocation failed\n");
         return rv;
     }
 
-    init_rwsem(&resp_lock);
-    init_rwsem(&board_lock);
+    //unbound, so searches spread over every cpu rather than the caller's
+    search_wq = alloc_workqueue("chess_search", WQ_UNBOUND, 0);
+    move_wq = alloc_workqueue("chess_move", WQ_UNBOUND, 0);
 
-    for (i = 0; i < 8; i++){
-        memcpy(board[i], empty, 8 * sizeof(char *));
+    if (search_wq == NULL || move_wq == NULL){
+        printk("Workqueue creation failed\n");
+        goto err_wq;
+    }
+
+    /*the cache has to exist before the device does, since
+      an open() can come in as soon as it is registered*/
+    session_cache = KMEM_CACHE(game_session, SLAB_HWCACHE_ALIGN);
+
+    if (session_cache == NULL){
+        printk("Session cache creation failed\n");
+        goto err_wq;
+    }
+
+    rv = misc_register(&game);
+
+    if (rv){
+        printk("Device registration failed\n");
+        kmem_cache_destroy(session_cache);
+        goto err_wq;
     }
 
     printk("initialized\n");
     
     return 0;
 
+err_wq:
+    if (move_wq){
+        destroy_workqueue(move_wq);
+    }
+
+    if (search_wq){
+        destroy_workqueue(search_wq);
+    }
+
+    vfree(tt);
+
+    return rv ? rv : -ENOMEM;
+
 }
 
 
 static void __exit game_exit(void)
 {
 
-    int i;
-
-    //delete all the promoted pieces stored and set to null
-    for (i = 0; i < 16; i++){
-        if (promoted_pieces[i] != NULL){
-            kfree(promoted_pieces[i]);
-            promoted_pieces[i] = NULL;
-        }
-    }
-
     misc_deregister(&game);
+    kmem_cache_destroy(session_cache);
+    destroy_workqueue(move_wq);
+    destroy_workqueue(search_wq);
+    kvfree(helpers);
+    vfree(tt);
 
     printk("exiting\n");
 
@@ -1685,4 +2726,4 @@ static void __exit game_exit(void)
 
 
 module_init(game_init);
-module_exit(game_exit);
\ No newline at end of file
+module_exit(game_exit);
\ No newline at end of file
@@ -0,0 +1,79 @@
+/*the little the engine core in chess_engine.h needs from its
+  surroundings. Built into the module (__KERNEL__) it is the kernel's own
+  headers, built into a userspace tool it is libc and a few compiler
+  builtins standing in for the kernel helpers of the same name*/
+
+#ifndef CHESS_COMPAT_H
+#define CHESS_COMPAT_H
+
+#ifdef __KERNEL__
+
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/bitops.h>
+#include <linux/bug.h>
+#include <linux/cache.h>
+#include <linux/compiler.h>
+#include <linux/sched.h>
+#include <linux/sched/signal.h>
+#include <linux/workqueue.h>
+#include <linux/timekeeping.h>
+
+//perft runs in the caller's syscall and gives up on a pending signal
+#define engineInterrupted()     signal_pending(current)
+
+//monotonic nanoseconds, what a search's deadline is held to
+#define engineClock()           ktime_get_ns()
+
+#else
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <assert.h>
+#include <time.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef int64_t s64;
+
+//index of the lowest set bit, x is never 0
+#define __ffs64(x)              ((unsigned long) __builtin_ctzll(x))
+#define hweight64(x)            ((unsigned long) __builtin_popcountll(x))
+
+#define READ_ONCE(x)            (*(const volatile __typeof__(x) *) &(x))
+#define WRITE_ONCE(x, val)      (*(volatile __typeof__(x) *) &(x) = (val))
+
+#define WARN_ON_ONCE(cond)      assert(!(cond))
+
+#define ____cacheline_aligned   __attribute__((aligned(64)))
+#define noinline                __attribute__((noinline))
+
+//a userspace search owns its thread, there is nothing to yield to or be interrupted by
+#define cond_resched()          do { } while (0)
+#define engineInterrupted()     false
+
+static inline u64 engineClock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*the module runs Lazy SMP helpers as work items embedded in struct
+  search, userspace never queues one*/
+struct work_struct {
+    void (*func)(struct work_struct *work);
+};
+
+#endif
+
+#endif
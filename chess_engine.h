@@ -0,0 +1,1836 @@
+/*the engine core: the board, legal move generation, check and mate
+  detection, the search and perft. It knows nothing of sessions, files
+  or locks, so it builds both into the module and into userspace tools
+  such as chessbench, see chess_compat.h for the difference.
+
+  Everything here is static and the one file that includes it gets its
+  own copy, so the hot paths inline exactly as they did when they were
+  part of chess.c*/
+
+#ifndef CHESS_ENGINE_H
+#define CHESS_ENGINE_H
+
+#include "chess_compat.h"
+
+/*precomputed attack sets, ray/between/line masks and rook and bishop
+  magic bitboard tables, generated at build time by gentables.c. The 
+  leapers (king, knight, pawn) are a plain lookup, the sliders use magic
+  bitboards: the blockers on the relevant rays are multiplied by a magic
+  number whose top bits index a table of attack sets. It also holds the
+  Zobrist keys positions are hashed with*/
+#include "chess_tables.h"
+
+
+/*chess pieces. Every square of the board is a single byte: the low
+  three bits are the piece type and bits 3 and 4 are its colour, so an
+  empty square is 0 and belongs to neither side*/
+#define EMPTY   0
+#define PAWN    1
+#define KNIGHT  2
+#define BISHOP  3
+#define ROOK    4
+#define QUEEN   5
+#define KING    6
+
+#define WHITE   0x08
+#define BLACK   0x10
+
+#define PIECE_TYPE(p)   ((p) & 0x07)
+#define PIECE_COLOR(p)  ((p) & 0x18)
+
+//side index of a colour code: 0 for white, 1 for black
+#define SIDE(c)         ((c) >> 4)
+
+//square index of board[i][j], a1 = 0, h1 = 7, a8 = 56
+#define SQ(i, j)        ((i) * 8 + (j))
+
+
+/*a position: the board both as one byte per square and as a set of
+  bitboards, one bit per square. The two are kept in step by setSquare(),
+  and the whole thing is copied by value when the search wants a private
+  copy to work on*/
+struct position {
+
+    /*2d array of piece bytes, 64 bytes in total. A promoted pawn
+      is simply overwritten with its new piece byte*/
+    u8 board[8][8];
+
+    //bitboards indexed by piece type (pieces[EMPTY] is unused) and by side
+    u64 pieces[7];
+    u64 colors[2];
+
+    /*Zobrist key: the XOR of zobrist_pieces[][][] for every piece on the
+      board, and zobrist_side when black is to move. Kept up to date by
+      setSquare() and by whoever hands the move to the other side*/
+    u64 key;
+
+    /*the evaluation terms, also kept up to date by setSquare(): material
+      plus piece-square values for the middlegame and for the endgame,
+      from white's point of view, and the phase, see evaluate()*/
+    int mg;
+    int eg;
+    int phase;
+
+};
+
+
+
+/*the static evaluation. Every piece is worth its material plus a bonus
+  for the square it stands on, with one set of values for the middlegame
+  and one for the endgame. The tables are from white's side with a8 in
+  the top left corner, as a board is usually drawn, and black looks them
+  up mirrored. Only pawns and kings value squares differently as the
+  game goes on: pawns get worth more as they close in on promotion, and
+  the king leaves its shelter for the centre*/
+
+#define MG              0
+#define EG              1
+
+static const int material[2][7] = {
+    {0, 100, 320, 330, 500, 900, 0},
+    {0, 120, 300, 320, 530, 930, 0},
+};
+
+static const s16 pst[2][7][64] = {
+    {
+        {0},
+        {
+              0,   0,   0,   0,   0,   0,   0,   0,
+             50,  50,  50,  50,  50,  50,  50,  50,
+             10,  10,  20,  30,  30,  20,  10,  10,
+              5,   5,  10,  25,  25,  10,   5,   5,
+              0,   0,   0,  20,  20,   0,   0,   0,
+              5,  -5, -10,   0,   0, -10,  -5,   5,
+              5,  10,  10, -20, -20,  10,  10,   5,
+              0,   0,   0,   0,   0,   0,   0,   0,
+        },
+        {
+            -50, -40, -30, -30, -30, -30, -40, -50,
+            -40, -20,   0,   0,   0,   0, -20, -40,
+            -30,   0,  10,  15,  15,  10,   0, -30,
+            -30,   5,  15,  20,  20,  15,   5, -30,
+            -30,   0,  15,  20,  20,  15,   0, -30,
+            -30,   5,  10,  15,  15,  10,   5, -30,
+            -40, -20,   0,   5,   5,   0, -20, -40,
+            -50, -40, -30, -30, -30, -30, -40, -50,
+        },
+        {
+            -20, -10, -10, -10, -10, -10, -10, -20,
+            -10,   0,   0,   0,   0,   0,   0, -10,
+            -10,   0,   5,  10,  10,   5,   0, -10,
+            -10,   5,   5,  10,  10,   5,   5, -10,
+            -10,   0,  10,  10,  10,  10,   0, -10,
+            -10,  10,  10,  10,  10,  10,  10, -10,
+            -10,   5,   0,   0,   0,   0,   5, -10,
+            -20, -10, -10, -10, -10, -10, -10, -20,
+        },
+        {
+              0,   0,   0,   0,   0,   0,   0,   0,
+              5,  10,  10,  10,  10,  10,  10,   5,
+             -5,   0,   0,   0,   0,   0,   0,  -5,
+             -5,   0,   0,   0,   0,   0,   0,  -5,
+             -5,   0,   0,   0,   0,   0,   0,  -5,
+             -5,   0,   0,   0,   0,   0,   0,  -5,
+             -5,   0,   0,   0,   0,   0,   0,  -5,
+              0,   0,   0,   5,   5,   0,   0,   0,
+        },
+        {
+            -20, -10, -10,  -5,  -5, -10, -10, -20,
+            -10,   0,   0,   0,   0,   0,   0, -10,
+            -10,   0,   5,   5,   5,   5,   0, -10,
+             -5,   0,   5,   5,   5,   5,   0,  -5,
+              0,   0,   5,   5,   5,   5,   0,  -5,
+            -10,   5,   5,   5,   5,   5,   0, -10,
+            -10,   0,   5,   0,   0,   0,   0, -10,
+            -20, -10, -10,  -5,  -5, -10, -10, -20,
+        },
+        {
+            -30, -40, -40, -50, -50, -40, -40, -30,
+            -30, -40, -40, -50, -50, -40, -40, -30,
+            -30, -40, -40, -50, -50, -40, -40, -30,
+            -30, -40, -40, -50, -50, -40, -40, -30,
+            -20, -30, -30, -40, -40, -30, -30, -20,
+            -10, -20, -20, -20, -20, -20, -20, -10,
+             20,  20,   0,   0,   0,   0,  20,  20,
+             20,  30,  10,   0,   0,  10,  30,  20,
+        },
+    },
+    {
+        {0},
+        {
+              0,   0,   0,   0,   0,   0,   0,   0,
+             80,  80,  80,  80,  80,  80,  80,  80,
+             50,  50,  50,  50,  50,  50,  50,  50,
+             30,  30,  30,  30,  30,  30,  30,  30,
+             15,  15,  15,  15,  15,  15,  15,  15,
+              5,   5,   5,   5,   5,   5,   5,   5,
+              0,   0,   0,   0,   0,   0,   0,   0,
+              0,   0,   0,   0,   0,   0,   0,   0,
+        },
+        {
+            -50, -40, -30, -30, -30, -30, -40, -50,
+            -40, -20,   0,   0,   0,   0, -20, -40,
+            -30,   0,  10,  15,  15,  10,   0, -30,
+            -30,   5,  15,  20,  20,  15,   5, -30,
+            -30,   0,  15,  20,  20,  15,   0, -30,
+            -30,   5,  10,  15,  15,  10,   5, -30,
+            -40, -20,   0,   5,   5,   0, -20, -40,
+            -50, -40, -30, -30, -30, -30, -40, -50,
+        },
+        {
+            -20, -10, -10, -10, -10, -10, -10, -20,
+            -10,   0,   0,   0,   0,   0,   0, -10,
+            -10,   0,   5,  10,  10,   5,   0, -10,
+            -10,   5,   5,  10,  10,   5,   5, -10,
+            -10,   0,  10,  10,  10,  10,   0, -10,
+            -10,  10,  10,  10,  10,  10,  10, -10,
+            -10,   5,   0,   0,   0,   0,   5, -10,
+            -20, -10, -10, -10, -10, -10, -10, -20,
+        },
+        {
+              0,   0,   0,   0,   0,   0,   0,   0,
+              5,  10,  10,  10,  10,  10,  10,   5,
+             -5,   0,   0,   0,   0,   0,   0,  -5,
+             -5,   0,   0,   0,   0,   0,   0,  -5,
+             -5,   0,   0,   0,   0,   0,   0,  -5,
+             -5,   0,   0,   0,   0,   0,   0,  -5,
+             -5,   0,   0,   0,   0,   0,   0,  -5,
+              0,   0,   0,   5,   5,   0,   0,   0,
+        },
+        {
+            -20, -10, -10,  -5,  -5, -10, -10, -20,
+            -10,   0,   0,   0,   0,   0,   0, -10,
+            -10,   0,   5,   5,   5,   5,   0, -10,
+             -5,   0,   5,   5,   5,   5,   0,  -5,
+              0,   0,   5,   5,   5,   5,   0,  -5,
+            -10,   5,   5,   5,   5,   5,   0, -10,
+            -10,   0,   5,   0,   0,   0,   0, -10,
+            -20, -10, -10,  -5,  -5, -10, -10, -20,
+        },
+        {
+            -50, -40, -30, -20, -20, -30, -40, -50,
+            -30, -20, -10,   0,   0, -10, -20, -30,
+            -30, -10,  20,  30,  30,  20, -10, -30,
+            -30, -10,  30,  40,  40,  30, -10, -30,
+            -30, -10,  30,  40,  40,  30, -10, -30,
+            -30, -10,  20,  30,  30,  20, -10, -30,
+            -30, -30,   0,   0,   0,   0, -30, -30,
+            -50, -30, -30, -30, -30, -30, -30, -50,
+        },
+    },
+};
+
+/*how much each piece counts towards the middlegame. All of them make
+  PHASE_MAX, the starting position, and bare kings make 0*/
+static const int phase_weights[7] = {0, 0, 1, 1, 2, 4, 0};
+
+#define PHASE_MAX       24
+
+
+
+static inline u64 rookAttacks(int sq, u64 occ)
+{
+    const struct magic *m = &rook_magics[sq];
+
+    return m->attacks[((occ & m->mask) * m->magic) >> m->shift];
+}
+
+
+static inline u64 bishopAttacks(int sq, u64 occ)
+{
+    const struct magic *m = &bishop_magics[sq];
+
+    return m->attacks[((occ & m->mask) * m->magic) >> m->shift];
+}
+
+
+/*checks if square sq is attacked by any piece of colour "by", given
+  the occupancy occ*/
+static bool attacked(const struct position *pos, int sq, u8 by, u64 occ)
+{
+    u64 them = pos->colors[SIDE(by)];
+
+    if (pawn_attacks[SIDE(by) ^ 1][sq] & pos->pieces[PAWN] & them){
+        return true;
+    }
+
+    if (knight_attacks[sq] & pos->pieces[KNIGHT] & them){
+        return true;
+    }
+
+    if (king_attacks[sq] & pos->pieces[KING] & them){
+        return true;
+    }
+
+    if (rookAttacks(sq, occ) & (pos->pieces[ROOK] | pos->pieces[QUEEN]) & them){
+        return true;
+    }
+
+    return (bishopAttacks(sq, occ) & (pos->pieces[BISHOP] | pos->pieces[QUEEN]) & them) != 0;
+}
+
+
+//every piece of colour "by" attacking square sq, given the occupancy occ
+static u64 attackersTo(const struct position *pos, int sq, u8 by, u64 occ)
+{
+    u64 attackers;
+
+    attackers = pawn_attacks[SIDE(by) ^ 1][sq] & pos->pieces[PAWN];
+    attackers |= knight_attacks[sq] & pos->pieces[KNIGHT];
+    attackers |= king_attacks[sq] & pos->pieces[KING];
+    attackers |= rookAttacks(sq, occ) & (pos->pieces[ROOK] | pos->pieces[QUEEN]);
+    attackers |= bishopAttacks(sq, occ) & (pos->pieces[BISHOP] | pos->pieces[QUEEN]);
+
+    return attackers & pos->colors[SIDE(by)];
+}
+
+
+//piece byte on square sq
+static inline u8 pieceAt(const struct position *pos, int sq)
+{
+    return pos->board[sq >> 3][sq & 7];
+}
+
+
+//what piece on sq is worth in stage MG or EG, from white's point of view
+static inline int pieceScore(u8 piece, int sq, int stage)
+{
+    u8 type = PIECE_TYPE(piece);
+
+    if (PIECE_COLOR(piece) == WHITE){
+        return material[stage][type] + pst[stage][type][sq ^ 56];
+    }
+
+    return -(material[stage][type] + pst[stage][type][sq]);
+}
+
+
+/*the one place a square is written, so board[][], the bitboards, the
+  key and the evaluation terms agree*/
+static void setSquare(struct position *pos, int sq, u8 piece)
+{
+    u8 old = pieceAt(pos, sq);
+    u64 bit = 1ULL << sq;
+
+    if (old != EMPTY){
+        pos->pieces[PIECE_TYPE(old)] &= ~bit;
+        pos->colors[SIDE(PIECE_COLOR(old))] &= ~bit;
+        pos->key ^= zobrist_pieces[SIDE(PIECE_COLOR(old))][PIECE_TYPE(old)][sq];
+
+        pos->mg -= pieceScore(old, sq, MG);
+        pos->eg -= pieceScore(old, sq, EG);
+        pos->phase -= phase_weights[PIECE_TYPE(old)];
+    }
+
+    if (piece != EMPTY){
+        pos->pieces[PIECE_TYPE(piece)] |= bit;
+        pos->colors[SIDE(PIECE_COLOR(piece))] |= bit;
+        pos->key ^= zobrist_pieces[SIDE(PIECE_COLOR(piece))][PIECE_TYPE(piece)][sq];
+
+        pos->mg += pieceScore(piece, sq, MG);
+        pos->eg += pieceScore(piece, sq, EG);
+        pos->phase += phase_weights[PIECE_TYPE(piece)];
+    }
+
+    pos->board[sq >> 3][sq & 7] = piece;
+}
+
+
+//the Zobrist key of pos computed from scratch, with "side" to move
+static u64 positionKey(const struct position *pos, u8 side)
+{
+    u64 key = (side == BLACK) ? zobrist_side : 0;
+    int sq;
+
+    for (sq = 0; sq < 64; sq++){
+        u8 piece = pieceAt(pos, sq);
+
+        if (piece != EMPTY){
+            key ^= zobrist_pieces[SIDE(PIECE_COLOR(piece))][PIECE_TYPE(piece)][sq];
+        }
+    }
+
+    return key;
+}
+
+
+//sets pos's evaluation terms from scratch
+static void positionScore(struct position *pos)
+{
+    int sq;
+
+    pos->mg = 0;
+    pos->eg = 0;
+    pos->phase = 0;
+
+    for (sq = 0; sq < 64; sq++){
+        u8 piece = pieceAt(pos, sq);
+
+        if (piece != EMPTY){
+            pos->mg += pieceScore(piece, sq, MG);
+            pos->eg += pieceScore(piece, sq, EG);
+            pos->phase += phase_weights[PIECE_TYPE(piece)];
+        }
+    }
+}
+
+
+/*debug builds (make CHESS_DEBUG=y) check the incrementally updated key
+  and evaluation terms against ones computed from scratch after every move*/
+#ifdef CHESS_DEBUG
+static bool scoreDrifted(const struct position *pos)
+{
+    struct position scratch = *pos;
+
+    positionScore(&scratch);
+
+    return scratch.mg != pos->mg || scratch.eg != pos->eg || scratch.phase != pos->phase;
+}
+
+#define verifyKey(pos, side)    WARN_ON_ONCE((pos)->key != positionKey((pos), (side)) || scoreDrifted(pos))
+#else
+#define verifyKey(pos, side)    do { } while (0)
+#endif
+
+
+/*rebuilds the bitboards, the key and the evaluation terms from board[][],
+  only needed after a bulk reset. The key is computed with white to move*/
+static void syncBitboards(struct position *pos)
+{
+    int sq;
+
+    memset(pos->pieces, 0, sizeof(pos->pieces));
+    memset(pos->colors, 0, sizeof(pos->colors));
+
+    for (sq = 0; sq < 64; sq++){
+        u8 piece = pieceAt(pos, sq);
+
+        if (piece != EMPTY){
+            pos->pieces[PIECE_TYPE(piece)] |= 1ULL << sq;
+            pos->colors[SIDE(PIECE_COLOR(piece))] |= 1ULL << sq;
+        }
+    }
+
+    pos->key = positionKey(pos, WHITE);
+    positionScore(pos);
+}
+
+
+/*the computer's engine. It works on a private copy of the position
+  in a struct search: legal move generation, make/unmake, and a
+  negamax alpha-beta search driven by iterative deepening*/
+
+//moves are packed into 16 bits: from square, to square, promotion type
+#define MOVE(from, to, promo)   ((u16) ((from) | ((to) << 6) | ((promo) << 12)))
+#define MOVE_FROM(m)            ((m) & 0x3f)
+#define MOVE_TO(m)              (((m) >> 6) & 0x3f)
+#define MOVE_PROMO(m)           ((m) >> 12)
+#define MOVE_NONE               0
+
+//the other colour
+#define OTHER(c)        ((c) ^ (WHITE | BLACK))
+
+#define MAX_PLY         64
+#define MAX_MOVES       256
+
+/*the deepest search, and the most plies of captures quiesce() looks
+  at below it. In the module the recursion runs on the kernel stack,
+  so there MAX_DEPTH is capped low enough that a negamax() and a
+  quiesce() frame per ply fit with room to spare*/
+#ifdef __KERNEL__
+#define MAX_DEPTH       16
+#else
+#define MAX_DEPTH       32
+#endif
+
+#define QUIESCE_PLY     8
+
+#define INFINITE        32000
+#define MATE_SCORE      31000
+
+//the node and time budgets and the scheduler are looked at every this many nodes
+#define CHECK_NODES     1024
+
+#define MAX_THREADS     64
+
+/*the selective parts of the search, each of which can be left out of a
+  search through its features to measure what it saves, see negamax()*/
+#define SEARCH_NULL_MOVE        (1 << 0)
+#define SEARCH_LMR              (1 << 1)
+#define SEARCH_FUTILITY         (1 << 2)
+#define SEARCH_PVS              (1 << 3)
+#define SEARCH_ASPIRATION       (1 << 4)
+#define SEARCH_ALL              0x1f
+
+
+struct search {
+
+    //the position being searched and the side to move in it
+    struct position pos;
+    u8 side;
+    int ply;
+
+    //limits for this search, node_limit and time_limit (in ns) 0 are unlimited
+    unsigned int start_depth;
+    unsigned int max_depth;
+    u64 node_limit;
+    u64 time_limit;
+
+    //engineClock() time_limit runs out at, 0 for none, set by think()
+    u64 deadline;
+
+    //SEARCH_* techniques this search uses
+    unsigned int features;
+
+    //nodes searched, and how many of them were in quiesce()
+    u64 nodes;
+    u64 qnodes;
+    bool stopped;
+
+    /*Lazy SMP: main points at the main search (itself, for the main
+      search), whose finished flag tells the helpers to stop*/
+    struct search *main;
+    bool finished;
+    struct work_struct work;
+
+    //best root move of the last completed iteration and of the current one
+    u16 best;
+    u16 iter_best;
+    int score;
+    unsigned int depth_done;
+
+    //age stamped on the transposition table entries this search stores
+    u8 age;
+
+    u64 tt_probes;
+    u64 tt_hits;
+    u64 tt_collisions;
+
+    //beta cutoffs, and how many of them the first move searched gave
+    u64 cutoffs;
+    u64 first_cutoffs;
+
+    //set while a null move cutoff is verified, no null move is tried below it
+    bool verifying;
+
+    /*per ply move lists, their ordering scores, the move made at each ply
+      (MOVE_NONE for a null move) and the piece it captured*/
+    u16 played[MAX_PLY];
+    u8 captured[MAX_PLY];
+    u16 moves[MAX_PLY][MAX_MOVES];
+    s16 order[MAX_PLY][MAX_MOVES];
+
+    /*move ordering memory, see scoreMoves(). Killers are the last two
+      quiet moves to cause a cutoff at each ply, history how often a
+      quiet move from one square to another has, for each side. Killers
+      start over with every search, history is only halved*/
+    u16 killers[MAX_PLY][2];
+    u32 history[2][64][64];
+
+    //perft's leaf count below each root move in moves[0]
+    u64 divide[MAX_MOVES];
+
+};
+
+
+//squares a non pawn piece of type "type" on sq attacks, given occupancy occ
+static u64 pieceTargets(u8 type, int sq, u64 occ)
+{
+    switch (type){
+    case KNIGHT:
+        return knight_attacks[sq];
+    case BISHOP:
+        return bishopAttacks(sq, occ);
+    case ROOK:
+        return rookAttacks(sq, occ);
+    case QUEEN:
+        return rookAttacks(sq, occ) | bishopAttacks(sq, occ);
+    case KING:
+        return king_attacks[sq];
+    default:
+        return 0;
+    }
+}
+
+
+//is side's king attacked. A side without a king is never in check
+static bool inCheck(const struct position *pos, u8 side)
+{
+    u64 king = pos->pieces[KING] & pos->colors[SIDE(side)];
+
+    if (king == 0){
+        return false;
+    }
+
+    return attacked(pos, __ffs64(king), OTHER(side), pos->colors[0] | pos->colors[1]);
+}
+
+
+/*the mailbox in-check test, the module's alternative to inCheck() and
+  what chessbench verify holds it to. From player's king it walks
+  outward along the 8 lines until a piece blocks each, then looks at the
+  8 squares a knight could check from. The pawns that take towards the
+  king are the ones a diagonal step ahead of it*/
+static inline bool mailboxCheck(const struct position *pos, u8 player)
+{
+    static const int lines[8][2] = {
+        {1, 0}, {-1, 0}, {0, 1}, {0, -1}, {1, 1}, {1, -1}, {-1, 1}, {-1, -1}
+    };
+
+    static const int jumps[8][2] = {
+        {1, 2}, {2, 1}, {-1, 2}, {-2, 1}, {1, -2}, {2, -1}, {-1, -2}, {-2, -1}
+    };
+
+    u8 opponent = OTHER(player);
+    int ahead = (player == WHITE) ? 1 : -1;
+    int i, j, k, inc, m, n;
+    u8 piece, type;
+
+    for (k = 0; k < 64 && pos->board[k >> 3][k & 7] != (player | KING); k++){
+    }
+
+    if (k == 64){
+        return false;
+    }
+
+    i = k >> 3;
+    j = k & 7;
+
+    //the first 4 lines are a rook's, the rest a bishop's
+    for (k = 0; k < 8; k++){
+        for (inc = 1; inc < 8; inc++){
+            m = i + lines[k][0] * inc;
+            n = j + lines[k][1] * inc;
+
+            if (m < 0 || m > 7 || n < 0 || n > 7){
+                break;
+            }
+
+            piece = pos->board[m][n];
+
+            if (piece == EMPTY){
+                continue;
+            }
+
+            if (PIECE_COLOR(piece) == opponent){
+                type = PIECE_TYPE(piece);
+
+                if (type == QUEEN || (type == ROOK && k < 4) || (type == BISHOP && k >= 4)){
+                    return true;
+                }
+
+                if (inc == 1 && (type == KING || (type == PAWN && k >= 4 && lines[k][0] == ahead))){
+                    return true;
+                }
+            }
+
+            //any piece blocks the rest of the line
+            break;
+        }
+    }
+
+    for (k = 0; k < 8; k++){
+        m = i + jumps[k][0];
+        n = j + jumps[k][1];
+
+        if (m >= 0 && m <= 7 && n >= 0 && n <= 7 && pos->board[m][n] == (opponent | KNIGHT)){
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/*writes every legal move of side into list and returns how many there
+  are. Pawns push one or two squares and capture diagonally, and promote
+  to a queen, rook, bishop or knight. There is no castling or en passant
+  since the protocol has no way to express either.
+
+  Nothing is made and taken back to test a move. The pieces giving check
+  and the pieces pinned to the king are found once per position: under a
+  single check every other move has to capture the checker or block it,
+  under a double check only the king moves, and a pinned piece only moves
+  along the line through it and its king. The king steps to squares not
+  attacked with it lifted off the board, so it can't hide behind itself.
+
+  With any set it stops at the first legal move it finds, which needs
+  room for four in list, see hasLegalMove(). With captures set it only
+  generates captures and queen promotions, for quiesce()*/
+static inline int generate(const struct position *pos, u8 side, u16 *list, bool any, bool captures)
+{
+    u64 own = pos->colors[SIDE(side)];
+    u64 them = pos->colors[SIDE(side) ^ 1];
+    u64 occ = own | them;
+    u64 king = pos->pieces[KING] & own;
+    u64 pieces, targets, snipers;
+
+    //what every non king move is held to
+    u64 checkers = 0;
+    u64 pinned = 0;
+    u64 allowed = ~0ULL;
+
+    int n = 0;
+    int ksq = -1;
+    int from, to;
+
+    //pawn geometry for this side
+    int up = (side == WHITE) ? 8 : -8;
+    u64 start_rank = (side == WHITE) ? 0x000000000000ff00ULL : 0x00ff000000000000ULL;
+    u64 last_rank = (side == WHITE) ? 0xff00000000000000ULL : 0x00000000000000ffULL;
+
+    //a side without a king (never the case in a game) moves freely
+    if (king){
+        ksq = __ffs64(king);
+        checkers = attackersTo(pos, ksq, OTHER(side), occ);
+
+        //a slider lined up with the king pins a lone piece of ours in between
+        snipers = (rook_rays[ksq] & (pos->pieces[ROOK] | pos->pieces[QUEEN])) | (bishop_rays[ksq] & (pos->pieces[BISHOP] | pos->pieces[QUEEN]));
+        snipers &= them;
+
+        while (snipers){
+            u64 between = between_masks[ksq][__ffs64(snipers)] & occ;
+
+            snipers &= snipers - 1;
+
+            if (between && !(between & (between - 1)) && (between & own)){
+                pinned |= between;
+            }
+        }
+
+        if (checkers & (checkers - 1)){
+            allowed = 0;
+        }
+
+        else if (checkers){
+            allowed = checkers | between_masks[ksq][__ffs64(checkers)];
+        }
+    }
+
+    pieces = pos->pieces[PAWN] & own;
+
+    while (pieces){
+        from = __ffs64(pieces);
+        pieces &= pieces - 1;
+
+        targets = pawn_attacks[SIDE(side)][from] & them;
+
+        //a pawn left on the last rank by an unpromoted move can't push
+        if (!(last_rank & (1ULL << from)) && !(occ & (1ULL << (from + up)))){
+            targets |= 1ULL << (from + up);
+
+            if ((start_rank & (1ULL << from)) && !(occ & (1ULL << (from + 2 * up)))){
+                targets |= 1ULL << (from + 2 * up);
+            }
+        }
+
+        targets &= allowed;
+
+        if (captures){
+            targets &= them | last_rank;
+        }
+
+        if (pinned & (1ULL << from)){
+            targets &= line_masks[ksq][from];
+        }
+
+        while (targets){
+            to = __ffs64(targets);
+            targets &= targets - 1;
+
+            if (last_rank & (1ULL << to)){
+                list[n++] = MOVE(from, to, QUEEN);
+
+                if (!captures){
+                    list[n++] = MOVE(from, to, ROOK);
+                    list[n++] = MOVE(from, to, BISHOP);
+                    list[n++] = MOVE(from, to, KNIGHT);
+                }
+            }
+
+            else{
+                list[n++] = MOVE(from, to, EMPTY);
+            }
+
+            if (any){
+                return n;
+            }
+        }
+    }
+
+    pieces = own & ~pos->pieces[PAWN];
+
+    while (pieces){
+        from = __ffs64(pieces);
+        pieces &= pieces - 1;
+
+        targets = pieceTargets(PIECE_TYPE(pieceAt(pos, from)), from, occ) & (captures ? them : ~own);
+
+        if (from != ksq){
+            targets &= allowed;
+
+            if (pinned & (1ULL << from)){
+                targets &= line_masks[ksq][from];
+            }
+        }
+
+        while (targets){
+            to = __ffs64(targets);
+            targets &= targets - 1;
+
+            //the king's own square no longer blocks a slider's ray
+            if (from == ksq && attacked(pos, to, OTHER(side), occ ^ king)){
+                continue;
+            }
+
+            list[n++] = MOVE(from, to, EMPTY);
+
+            if (any){
+                return n;
+            }
+        }
+    }
+
+    return n;
+}
+
+
+static int generateMoves(const struct position *pos, u8 side, u16 *list)
+{
+    return generate(pos, side, list, false, false);
+}
+
+
+static int generateCaptures(const struct position *pos, u8 side, u16 *list)
+{
+    return generate(pos, side, list, false, true);
+}
+
+
+/*does side have any legal move at all. Without one it is mated if it
+  is in check and stalemated if not*/
+static inline bool hasLegalMove(const struct position *pos, u8 side)
+{
+    u16 list[4];
+
+    return generate(pos, side, list, true, false) != 0;
+}
+
+
+static void makeMove(struct search *s, u16 move)
+{
+    int from = MOVE_FROM(move);
+    int to = MOVE_TO(move);
+    u8 piece = pieceAt(&s->pos, from);
+
+    if (MOVE_PROMO(move) != EMPTY){
+        piece = s->side | MOVE_PROMO(move);
+    }
+
+    s->played[s->ply] = move;
+    s->captured[s->ply] = pieceAt(&s->pos, to);
+
+    setSquare(&s->pos, to, piece);
+    setSquare(&s->pos, from, EMPTY);
+
+    s->pos.key ^= zobrist_side;
+    s->side = OTHER(s->side);
+    s->ply++;
+
+    verifyKey(&s->pos, s->side);
+}
+
+
+static void unmakeMove(struct search *s, u16 move)
+{
+    int from = MOVE_FROM(move);
+    int to = MOVE_TO(move);
+    u8 piece;
+
+    s->ply--;
+    s->side = OTHER(s->side);
+
+    piece = pieceAt(&s->pos, to);
+
+    if (MOVE_PROMO(move) != EMPTY){
+        piece = s->side | PAWN;
+    }
+
+    setSquare(&s->pos, from, piece);
+    setSquare(&s->pos, to, s->captured[s->ply]);
+    s->pos.key ^= zobrist_side;
+
+    verifyKey(&s->pos, s->side);
+}
+
+
+//passes the move to the other side, see negamax()
+static void makeNull(struct search *s)
+{
+    s->played[s->ply] = MOVE_NONE;
+    s->captured[s->ply] = EMPTY;
+
+    s->pos.key ^= zobrist_side;
+    s->side = OTHER(s->side);
+    s->ply++;
+}
+
+
+static void unmakeNull(struct search *s)
+{
+    s->ply--;
+    s->side = OTHER(s->side);
+    s->pos.key ^= zobrist_side;
+}
+
+
+/*the middlegame and endgame scores blended by how much material is left,
+  from the side to move's point of view. Nothing is counted here, the
+  terms are kept up to date by every make and unmake. Promotions can
+  push the phase past PHASE_MAX, which still counts as a middlegame*/
+static int evaluate(const struct search *s)
+{
+    int phase = (s->pos.phase < PHASE_MAX) ? s->pos.phase : PHASE_MAX;
+    int score = (s->pos.mg * phase + s->pos.eg * (PHASE_MAX - phase)) / PHASE_MAX;
+
+    return (s->side == WHITE) ? score : -score;
+}
+
+
+/*static exchange evaluation: what the side making a capture wins on its
+  square once both sides have taken back as long as it pays them, each
+  always with its least valuable piece. Sliders behind the pieces that
+  took are found as those are lifted off the board. Pins are not looked
+  at, and the king, worth more than anything else, is only ever the last
+  piece to take*/
+
+static const int see_values[7] = {0, 100, 320, 330, 500, 900, 20000};
+
+//never inlined, so its swap list is only on the stack while it runs, not in every quiesce() frame
+static noinline int see(const struct position *pos, u16 move)
+{
+    u64 diag = pos->pieces[BISHOP] | pos->pieces[QUEEN];
+    u64 orth = pos->pieces[ROOK] | pos->pieces[QUEEN];
+    u64 occ = pos->colors[0] | pos->colors[1];
+    u64 attackers, mine;
+
+    int from = MOVE_FROM(move);
+    int to = MOVE_TO(move);
+    u8 side = PIECE_COLOR(pieceAt(pos, from));
+    u8 type = PIECE_TYPE(pieceAt(pos, from));
+
+    /*gain[d] is what the side making capture d has won if nothing takes
+      back, the last one only counts if there is a piece to make it*/
+    int gain[32];
+    int d = 0;
+
+    gain[0] = see_values[PIECE_TYPE(pieceAt(pos, to))];
+
+    if (MOVE_PROMO(move) != EMPTY){
+        type = MOVE_PROMO(move);
+        gain[0] += see_values[type] - see_values[PAWN];
+    }
+
+    attackers = attackersTo(pos, to, WHITE, occ) | attackersTo(pos, to, BLACK, occ);
+
+    do {
+        //the other side takes back whatever took last
+        d++;
+        gain[d] = see_values[type] - gain[d - 1];
+
+        occ ^= 1ULL << from;
+        attackers &= occ;
+        attackers |= ((rookAttacks(to, occ) & orth) | (bishopAttacks(to, occ) & diag)) & occ;
+
+        side = OTHER(side);
+        mine = attackers & pos->colors[SIDE(side)];
+
+        for (type = PAWN; type <= KING; type++){
+            if (mine & pos->pieces[type]){
+                from = __ffs64(mine & pos->pieces[type]);
+                break;
+            }
+        }
+    } while (mine && d < 31);
+
+    //each side only takes back when that beats leaving it be
+    while (--d){
+        if (-gain[d] < gain[d - 1]){
+            gain[d - 1] = -gain[d];
+        }
+    }
+
+    return gain[0];
+}
+
+
+/*transposition table, shared by every session and every search. It is
+  an array of cache line sized buckets of four entries. An entry is two
+  words, the packed data and the key XORed with that data, which are
+  read and written without any lock: an entry torn by two racing stores
+  fails the XOR check and is just a miss*/
+
+#define TT_BUCKET       4
+#define TT_MB_MAX       1024
+
+//what a stored score is: exact, a lower bound (fail high) or an upper bound (fail low)
+#define TT_EXACT        1
+#define TT_LOWER        2
+#define TT_UPPER        3
+
+//data word: move in bits 0-15, score 16-31, depth 32-39, bound 40-41, age 48-55
+#define TT_DATA(move, score, depth, bound, age) \
+    ((u64) (move) | ((u64) (u16) (score) << 16) | ((u64) (depth) << 32) | ((u64) (bound) << 40) | ((u64) (age) << 48))
+#define TT_MOVE(d)      ((u16) (d))
+#define TT_SCORE(d)     ((int) (s16) ((d) >> 16))
+#define TT_DEPTH(d)     ((int) (((d) >> 32) & 0xff))
+#define TT_BOUND(d)     ((int) (((d) >> 40) & 0x3))
+#define TT_AGE(d)       ((u8) ((d) >> 48))
+
+struct tt_entry {
+    u64 check;
+    u64 data;
+};
+
+struct tt_bucket {
+    struct tt_entry entries[TT_BUCKET];
+} ____cacheline_aligned;
+
+static struct tt_bucket *tt;
+static unsigned long tt_mask;
+
+
+//mate scores are stored relative to the node, not the root
+static int scoreToTT(int score, int ply)
+{
+    if (score >= MATE_SCORE - MAX_PLY){
+        return score + ply;
+    }
+
+    if (score <= -MATE_SCORE + MAX_PLY){
+        return score - ply;
+    }
+
+    return score;
+}
+
+
+static int scoreFromTT(int score, int ply)
+{
+    if (score >= MATE_SCORE - MAX_PLY){
+        return score - ply;
+    }
+
+    if (score <= -MATE_SCORE + MAX_PLY){
+        return score + ply;
+    }
+
+    return score;
+}
+
+
+//looks key up, true with its data word in *data on a hit
+static bool ttProbe(struct search *s, u64 key, u64 *data)
+{
+    struct tt_entry *e = tt[key & tt_mask].entries;
+    int k;
+
+    s->tt_probes++;
+
+    for (k = 0; k < TT_BUCKET; k++){
+        u64 d = READ_ONCE(e[k].data);
+        u64 c = READ_ONCE(e[k].check);
+
+        //data is never 0 for a stored entry, so an empty one never matches
+        if (d != 0 && (c ^ d) == key){
+            *data = d;
+            s->tt_hits++;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/*stores an entry over the same position if the bucket has it, otherwise
+  over an empty entry, then one left by an older search, then the
+  shallowest. Evicting another position stored by this search counts
+  as a collision*/
+static void ttStore(struct search *s, u64 key, u16 move, int score, int depth, int bound)
+{
+    struct tt_entry *e = tt[key & tt_mask].entries;
+    struct tt_entry *victim = &e[0];
+    int worst = INT_MAX;
+    u64 data;
+    int k;
+
+    for (k = 0; k < TT_BUCKET; k++){
+        u64 d = READ_ONCE(e[k].data);
+        u64 c = READ_ONCE(e[k].check);
+        int value;
+
+        if (d != 0 && (c ^ d) == key){
+            victim = &e[k];
+
+            //don't lose a known best move to a fail low
+            if (move == MOVE_NONE){
+                move = TT_MOVE(d);
+            }
+
+            goto store;
+        }
+
+        if (d == 0){
+            value = -1;
+        }
+
+        else{
+            value = TT_DEPTH(d) + ((TT_AGE(d) == s->age) ? 256 : 0);
+        }
+
+        if (value < worst){
+            worst = value;
+            victim = &e[k];
+        }
+    }
+
+    if (worst >= 256){
+        s->tt_collisions++;
+    }
+
+store:
+    data = TT_DATA(move, scoreToTT(score, s->ply), depth, bound, s->age);
+
+    WRITE_ONCE(victim->check, key ^ data);
+    WRITE_ONCE(victim->data, data);
+}
+
+
+
+/*move ordering. Each move gets a score and negamax() picks the best one
+  left just before searching it, so a node cut off after a move or two
+  never sorts the rest. In order: the hash move, captures by most
+  valuable victim then least valuable attacker (MVV-LVA), queen
+  promotions, the two killers, then everything else by history. Under
+  promotions sort last. Scores are kept as s16, order[] is the biggest
+  part of a search context*/
+
+#define ORDER_HASH      32000
+#define ORDER_CAPTURE   31000
+#define ORDER_KILLER    30000
+
+/*history entries are halved when one gets this big, and are scored
+  HISTORY_SHIFT bits down so they stay below ORDER_KILLER*/
+#define HISTORY_MAX     (1 << 20)
+#define HISTORY_SHIFT   6
+
+
+static void scoreMoves(struct search *s, int n, u16 hash)
+{
+    u16 *moves = s->moves[s->ply];
+    s16 *order = s->order[s->ply];
+    u16 *killers = s->killers[s->ply];
+    int k;
+
+    for (k = 0; k < n; k++){
+        u16 move = moves[k];
+        u8 victim = pieceAt(&s->pos, MOVE_TO(move));
+
+        if (move == hash){
+            order[k] = ORDER_HASH;
+        }
+
+        else if (victim != EMPTY){
+            order[k] = ORDER_CAPTURE + PIECE_TYPE(victim) * 8 - PIECE_TYPE(pieceAt(&s->pos, MOVE_FROM(move)));
+        }
+
+        else if (MOVE_PROMO(move) == QUEEN){
+            order[k] = ORDER_CAPTURE;
+        }
+
+        else if (MOVE_PROMO(move) != EMPTY){
+            order[k] = -1;
+        }
+
+        else if (move == killers[0]){
+            order[k] = ORDER_KILLER + 1;
+        }
+
+        else if (move == killers[1]){
+            order[k] = ORDER_KILLER;
+        }
+
+        else{
+            order[k] = s->history[SIDE(s->side)][MOVE_FROM(move)][MOVE_TO(move)] >> HISTORY_SHIFT;
+        }
+    }
+}
+
+
+//swaps the best scored of moves k to n - 1 into place k and returns it
+static inline u16 pickMove(struct search *s, int k, int n)
+{
+    u16 *moves = s->moves[s->ply];
+    s16 *order = s->order[s->ply];
+    int best = k;
+    int j, score;
+    u16 move;
+
+    for (j = k + 1; j < n; j++){
+        if (order[j] > order[best]){
+            best = j;
+        }
+    }
+
+    if (best != k){
+        move = moves[k];
+        moves[k] = moves[best];
+        moves[best] = move;
+
+        score = order[k];
+        order[k] = order[best];
+        order[best] = score;
+    }
+
+    return moves[k];
+}
+
+
+//a quiet move caused a cutoff depth plies from the horizon
+static void goodQuiet(struct search *s, u16 move, int depth)
+{
+    u16 *killers = s->killers[s->ply];
+    u32 *entry = &s->history[SIDE(s->side)][MOVE_FROM(move)][MOVE_TO(move)];
+
+    if (killers[0] != move){
+        killers[1] = killers[0];
+        killers[0] = move;
+    }
+
+    *entry += depth * depth;
+
+    if (*entry >= HISTORY_MAX){
+        u32 *h = &s->history[SIDE(s->side)][0][0];
+        int k;
+
+        for (k = 0; k < 64 * 64; k++){
+            h[k] >>= 1;
+        }
+    }
+}
+
+
+
+/*counts a node, and every CHECK_NODES of them sees whether the search
+  has to stop. True once it has. The node and time budgets are only held
+  to once an iteration has completed, so that there is a move to play*/
+static inline bool searchStop(struct search *s)
+{
+    if (s->stopped){
+        return true;
+    }
+
+    s->nodes++;
+
+    if ((s->nodes % CHECK_NODES) == 0){
+        bool spent = (s->node_limit && s->nodes >= s->node_limit) || (s->deadline && engineClock() >= s->deadline);
+
+        if ((spent && s->depth_done) || READ_ONCE(s->main->finished)){
+            s->stopped = true;
+            return true;
+        }
+
+        //a deep search must not hog the cpu it runs on
+        cond_resched();
+    }
+
+    return false;
+}
+
+
+//a capture that comes this far short of alpha is not searched
+#define DELTA_MARGIN    200
+
+
+/*quiescence search, where negamax() runs out of depth. The side to move
+  may stand on the static evaluation or try to better it with a capture,
+  so a piece left hanging at the horizon is seen to be. Captures that
+  can't get back to alpha even winning their victim for free (delta
+  pruning), and those that lose material on their square (see()), are
+  not searched. In check there is no standing, every evasion is tried.
+  qply counts the plies since negamax() ran out of depth, and at
+  QUIESCE_PLY the evaluation is taken as it is*/
+static int quiesce(struct search *s, int alpha, int beta, int qply)
+{
+    u16 *moves = s->moves[s->ply];
+    int n, k, score;
+    int stand = -INFINITE;
+    bool check;
+    u16 move;
+
+    s->qnodes++;
+
+    if (searchStop(s)){
+        return 0;
+    }
+
+    if (s->ply >= MAX_PLY - 1 || qply >= QUIESCE_PLY){
+        return evaluate(s);
+    }
+
+    check = inCheck(&s->pos, s->side);
+
+    if (check){
+        n = generateMoves(&s->pos, s->side, moves);
+
+        if (n == 0){
+            return -MATE_SCORE + s->ply;
+        }
+    }
+
+    else{
+        stand = evaluate(s);
+
+        if (stand >= beta){
+            return beta;
+        }
+
+        //not even a queen would do
+        if (stand + see_values[QUEEN] + DELTA_MARGIN < alpha){
+            return alpha;
+        }
+
+        if (stand > alpha){
+            alpha = stand;
+        }
+
+        n = generateCaptures(&s->pos, s->side, moves);
+    }
+
+    scoreMoves(s, n, MOVE_NONE);
+
+    for (k = 0; k < n; k++){
+        move = pickMove(s, k, n);
+
+        if (!check && MOVE_PROMO(move) == EMPTY){
+            if (stand + see_values[PIECE_TYPE(pieceAt(&s->pos, MOVE_TO(move)))] + DELTA_MARGIN <= alpha){
+                continue;
+            }
+
+            if (see(&s->pos, move) < 0){
+                continue;
+            }
+        }
+
+        makeMove(s, move);
+        score = -quiesce(s, -beta, -alpha, qply + 1);
+        unmakeMove(s, move);
+
+        if (s->stopped){
+            return 0;
+        }
+
+        if (score > alpha){
+            alpha = score;
+
+            if (alpha >= beta){
+                s->cutoffs++;
+                s->first_cutoffs += (k == 0);
+                break;
+            }
+        }
+    }
+
+    return alpha;
+}
+
+
+/*selective search constants. Null move searches R = NULL_R + depth / 6
+  plies less deep, and a cutoff deeper than NULL_VERIFY is checked with
+  a reduced search of the node itself. Futility is judged on the static
+  evaluation FUTILITY_MARGIN per ply of depth left from the window, up
+  to FUTILITY_DEPTH. Quiet moves from the LMR_MOVES-th on are reduced
+  from LMR_DEPTH, by less if they have a history of cutoffs*/
+#define NULL_R          2
+#define NULL_VERIFY     5
+#define FUTILITY_DEPTH  3
+#define FUTILITY_MARGIN 120
+#define LMR_DEPTH       3
+#define LMR_MOVES       3
+#define HISTORY_GOOD    (HISTORY_MAX >> 10 >> HISTORY_SHIFT)
+
+//the first aspiration window either side of the last score, from ASPIRATION_DEPTH
+#define ASPIRATION_WINDOW       25
+#define ASPIRATION_DEPTH        4
+
+
+//can side move anything but its king and pawns, when a null move is safe to try
+static inline bool hasPieces(const struct position *pos, u8 side)
+{
+    return (pos->colors[SIDE(side)] & ~(pos->pieces[PAWN] | pos->pieces[KING])) != 0;
+}
+
+
+/*negamax alpha-beta with principal variation search. Returns the score
+  of the position for the side to move, searched depth plies deep. Mate
+  scores are adjusted by ply so that a shorter mate always scores higher.
+  Once the search has been stopped the value returned is meaningless and
+  is thrown away.
+
+  Only the first move of a node gets the full window, the rest are
+  searched with a null window just to prove they are no better and only
+  searched again if they are (SEARCH_PVS). Outside the principal
+  variation, and out of check, a node also:
+
+    - returns its static evaluation if that beats beta by a margin
+      (reverse futility, SEARCH_FUTILITY)
+    - lets the other side move twice, and fails high if a reduced
+      search still can't get below beta (SEARCH_NULL_MOVE)
+    - skips quiet moves near the horizon that can't get back up to
+      alpha by a margin, unless they give check (SEARCH_FUTILITY)
+
+  and late quiet moves are searched less deep, again if they beat alpha
+  (SEARCH_LMR)*/
+static int negamax(struct search *s, int depth, int alpha, int beta)
+{
+    int n, k, r, score, verified, ordered;
+    int eval = 0;
+
+    int alpha_orig = alpha;
+    bool pv = beta - alpha > 1;
+    bool check, futile, quiet, research;
+    u16 best_move = MOVE_NONE;
+    u16 first = MOVE_NONE;
+    u16 move;
+    u64 data;
+
+    if (depth <= 0){
+        return quiesce(s, alpha, beta, 0);
+    }
+
+    if (searchStop(s)){
+        return 0;
+    }
+
+    if (s->ply >= MAX_PLY - 1){
+        return evaluate(s);
+    }
+
+    //a deep enough entry can answer the node outright, except at the root
+    if (ttProbe(s, s->pos.key, &data)){
+        first = TT_MOVE(data);
+
+        if (s->ply > 0 && TT_DEPTH(data) >= depth){
+            score = scoreFromTT(TT_SCORE(data), s->ply);
+
+            if (TT_BOUND(data) == TT_EXACT || (TT_BOUND(data) == TT_LOWER && score >= beta) || (TT_BOUND(data) == TT_UPPER && score <= alpha)){
+                return score;
+            }
+        }
+    }
+
+    check = inCheck(&s->pos, s->side);
+
+    if (!check){
+        eval = evaluate(s);
+    }
+
+    if (!pv && !check && (s->features & SEARCH_FUTILITY) && depth <= FUTILITY_DEPTH &&
+        beta < MATE_SCORE - MAX_PLY && eval - FUTILITY_MARGIN * depth >= beta){
+        return eval;
+    }
+
+    //never two null moves in a row, and never where zugzwang is likely
+    if (!pv && !check && (s->features & SEARCH_NULL_MOVE) && !s->verifying && depth > NULL_R &&
+        s->ply > 0 && s->played[s->ply - 1] != MOVE_NONE && eval >= beta && hasPieces(&s->pos, s->side)){
+        r = NULL_R + depth / 6;
+
+        makeNull(s);
+        score = -negamax(s, depth - 1 - r, -beta, -beta + 1);
+        unmakeNull(s);
+
+        if (s->stopped){
+            return 0;
+        }
+
+        if (score >= beta){
+            //an unproven mate is no better than beta
+            if (score >= MATE_SCORE - MAX_PLY){
+                score = beta;
+            }
+
+            if (depth <= NULL_VERIFY){
+                return score;
+            }
+
+            s->verifying = true;
+            verified = negamax(s, depth - r, beta - 1, beta);
+            s->verifying = false;
+
+            if (s->stopped){
+                return 0;
+            }
+
+            if (verified >= beta){
+                return score;
+            }
+        }
+    }
+
+    futile = !pv && !check && (s->features & SEARCH_FUTILITY) && depth <= FUTILITY_DEPTH &&
+             alpha > -MATE_SCORE + MAX_PLY && eval + FUTILITY_MARGIN * depth <= alpha;
+
+    n = generateMoves(&s->pos, s->side, s->moves[s->ply]);
+
+    //the hash move goes first, at the root the previous iteration's best move
+    if (s->ply == 0 && s->best != MOVE_NONE){
+        first = s->best;
+    }
+
+    scoreMoves(s, n, first);
+
+    for (k = 0; k < n; k++){
+        move = pickMove(s, k, n);
+        ordered = s->order[s->ply][k];
+        quiet = pieceAt(&s->pos, MOVE_TO(move)) == EMPTY && MOVE_PROMO(move) == EMPTY;
+
+        makeMove(s, move);
+
+        //whether it gives check is only worth working out for a quiet move
+        if (quiet && k > 0 && (futile || depth >= LMR_DEPTH) && inCheck(&s->pos, s->side)){
+            quiet = false;
+        }
+
+        if (futile && quiet && k > 0){
+            unmakeMove(s, move);
+            continue;
+        }
+
+        r = 0;
+
+        if ((s->features & SEARCH_LMR) && !check && quiet && depth >= LMR_DEPTH && k >= LMR_MOVES && ordered < ORDER_KILLER){
+            r = 1 + (depth >= 6 && k >= 2 * LMR_MOVES + 2);
+
+            if (ordered >= HISTORY_GOOD){
+                r--;
+            }
+
+            if (r > depth - 2){
+                r = depth - 2;
+            }
+        }
+
+        research = true;
+
+        if (r > 0){
+            score = -negamax(s, depth - 1 - r, -alpha - 1, -alpha);
+            research = score > alpha;
+        }
+
+        if (research && k > 0 && (s->features & SEARCH_PVS)){
+            score = -negamax(s, depth - 1, -alpha - 1, -alpha);
+            research = score > alpha && score < beta;
+        }
+
+        if (research){
+            score = -negamax(s, depth - 1, -beta, -alpha);
+        }
+
+        unmakeMove(s, move);
+
+        if (s->stopped){
+            return 0;
+        }
+
+        if (score > alpha){
+            alpha = score;
+            best_move = move;
+
+            if (s->ply == 0){
+                s->iter_best = move;
+            }
+
+            if (alpha >= beta){
+                s->cutoffs++;
+                s->first_cutoffs += (k == 0);
+
+                if (pieceAt(&s->pos, MOVE_TO(move)) == EMPTY && MOVE_PROMO(move) == EMPTY){
+                    goodQuiet(s, move, depth);
+                }
+
+                break;
+            }
+        }
+    }
+
+    //no legal move is either mate or stalemate
+    if (n == 0){
+        score = check ? -MATE_SCORE + s->ply : 0;
+        ttStore(s, s->pos.key, MOVE_NONE, score, depth, TT_EXACT);
+
+        return score;
+    }
+
+    if (alpha >= beta){
+        ttStore(s, s->pos.key, best_move, alpha, depth, TT_LOWER);
+    }
+
+    else if (alpha > alpha_orig){
+        ttStore(s, s->pos.key, best_move, alpha, depth, TT_EXACT);
+    }
+
+    else{
+        ttStore(s, s->pos.key, MOVE_NONE, alpha, depth, TT_UPPER);
+    }
+
+    return alpha;
+}
+
+
+/*the root searched depth plies deep. From ASPIRATION_DEPTH on the window
+  is first a narrow one around the last iteration's score, and whichever
+  side the score falls out of is widened, twice as far each time, until
+  it lands inside (SEARCH_ASPIRATION)*/
+static int aspirate(struct search *s, int depth)
+{
+    int delta = ASPIRATION_WINDOW;
+    int alpha = -INFINITE;
+    int beta = INFINITE;
+    int score;
+
+    if ((s->features & SEARCH_ASPIRATION) && depth >= ASPIRATION_DEPTH &&
+        s->score > -MATE_SCORE + MAX_PLY && s->score < MATE_SCORE - MAX_PLY){
+        alpha = s->score - delta;
+        beta = s->score + delta;
+    }
+
+    for (;;){
+        s->iter_best = MOVE_NONE;
+
+        score = negamax(s, depth, alpha, beta);
+
+        if (s->stopped){
+            return 0;
+        }
+
+        delta *= 2;
+
+        if (score <= alpha && alpha > -INFINITE){
+            alpha = (score - delta > -INFINITE) ? score - delta : -INFINITE;
+        }
+
+        else if (score >= beta && beta < INFINITE){
+            beta = (score + delta < INFINITE) ? score + delta : INFINITE;
+        }
+
+        else{
+            return score;
+        }
+    }
+}
+
+
+/*iterative deepening: searches depth start_depth, start_depth + 1, ...
+  up to max_depth and returns the best move of the deepest iteration
+  that completed, or MOVE_NONE if the side to move has no legal move.
+  A search starting at depth 1 always completes it, see searchStop(),
+  and so always has a move. An iteration takes longer than the ones
+  before it, so none is started with less than half of time_limit left*/
+static u16 think(struct search *s)
+{
+    unsigned int depth;
+    int score, k;
+    u64 start = engineClock();
+
+    s->ply = 0;
+    s->nodes = 0;
+    s->qnodes = 0;
+    s->stopped = false;
+    s->verifying = false;
+    s->deadline = s->time_limit ? start + s->time_limit : 0;
+    s->best = MOVE_NONE;
+    s->score = 0;
+    s->depth_done = 0;
+
+    s->tt_probes = 0;
+    s->tt_hits = 0;
+    s->tt_collisions = 0;
+
+    s->cutoffs = 0;
+    s->first_cutoffs = 0;
+
+    //killers belong to the position searched last, history is only aged
+    memset(s->killers, 0, sizeof(s->killers));
+
+    for (k = 0; k < 2 * 64 * 64; k++){
+        (&s->history[0][0][0])[k] >>= 1;
+    }
+
+    for (depth = s->start_depth; depth <= s->max_depth; depth++){
+        score = aspirate(s, depth);
+
+        if (s->stopped){
+            break;
+        }
+
+        s->best = s->iter_best;
+        s->score = score;
+        s->depth_done = depth;
+
+        //nothing to play, or a forced mate has already been found
+        if (s->best == MOVE_NONE || score >= MATE_SCORE - MAX_PLY){
+            break;
+        }
+
+        if (s->deadline && engineClock() - start >= s->time_limit / 2){
+            break;
+        }
+    }
+
+    return s->best;
+}
+
+
+/*leaf nodes depth plies below the position in s, depth at least 1.
+  The generator is legal, so the last ply is counted rather than made*/
+static u64 perft(struct search *s, unsigned int depth)
+{
+    u16 *moves = s->moves[s->ply];
+    int n = generateMoves(&s->pos, s->side, moves);
+    u64 nodes = 0;
+    int k;
+
+    if (depth == 1){
+        return n;
+    }
+
+    //in the module perft runs in the caller's write() or ioctl(), so it can be interrupted
+    if ((++s->nodes % CHECK_NODES) == 0){
+        if (engineInterrupted()){
+            s->stopped = true;
+        }
+
+        cond_resched();
+    }
+
+    for (k = 0; k < n && !s->stopped; k++){
+        makeMove(s, moves[k]);
+        nodes += perft(s, depth - 1);
+        unmakeMove(s, moves[k]);
+    }
+
+    return nodes;
+}
+
+
+
+/*perft split by root move: moves[0] gets the root moves and divide[]
+  the leaf nodes below each of them. Returns how many root moves*/
+static inline int perftDivide(struct search *s, unsigned int depth)
+{
+    u16 *moves = s->moves[0];
+    int n, k;
+
+    s->ply = 0;
+    s->nodes = 0;
+    s->stopped = false;
+
+    n = generateMoves(&s->pos, s->side, moves);
+
+    for (k = 0; k < n; k++){
+        s->divide[k] = 1;
+
+        if (depth > 1){
+            makeMove(s, moves[k]);
+            s->divide[k] = perft(s, depth - 1);
+            unmakeMove(s, moves[k]);
+        }
+    }
+
+    return n;
+}
+
+
+
+static const char start_fen[] = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w";
+
+/*sets pos and side from the first two fields of a FEN string, the
+  placement and the side to move. The rest is ignored, there is no
+  castling or en passant to describe. Each side needs exactly one king
+  and the side that just moved can't be in check. Returns false for
+  anything else*/
+static bool parseFen(const char *fen, struct position *pos, u8 *side)
+{
+    static const char fen_types[] = "PNBRQK";
+
+    int rank = 7, file = 0;
+    const char *letter;
+    u8 color;
+    char type;
+
+    memset(pos->board, EMPTY, sizeof(pos->board));
+
+    for (; *fen != ' '; fen++){
+
+        if (*fen == '\0'){
+            return false;
+        }
+
+        if (*fen == '/'){
+            if (file != 8 || rank == 0){
+                return false;
+            }
+
+            rank--;
+            file = 0;
+        }
+
+        else if (*fen >= '1' && *fen <= '8'){
+            file += *fen - '0';
+
+            if (file > 8){
+                return false;
+            }
+        }
+
+        //white pieces are upper case, black ones lower case
+        else{
+            color = (*fen >= 'a') ? BLACK : WHITE;
+            type = (color == BLACK) ? *fen - 'a' + 'A' : *fen;
+            letter = strchr(fen_types, type);
+
+            if (letter == NULL || file > 7){
+                return false;
+            }
+
+            pos->board[rank][file++] = color | (letter - fen_types + 1);
+        }
+    }
+
+    if (rank != 0 || file != 8){
+        return false;
+    }
+
+    fen++;
+
+    if ((fen[0] != 'w' && fen[0] != 'b') || (fen[1] != '\0' && fen[1] != ' ')){
+        return false;
+    }
+
+    *side = (fen[0] == 'w') ? WHITE : BLACK;
+
+    syncBitboards(pos);
+
+    if (*side == BLACK){
+        pos->key ^= zobrist_side;
+    }
+
+    if (hweight64(pos->pieces[KING] & pos->colors[0]) != 1 || hweight64(pos->pieces[KING] & pos->colors[1]) != 1){
+        return false;
+    }
+
+    return !inCheck(pos, OTHER(*side));
+}
+
+#endif
@@ -0,0 +1,164 @@
+/*binary ioctl interface to /dev/chess, shared by the module and userspace.
+
+  Every call is one fixed size struct in and out: the request goes in,
+  and the result code and any payload come back in the same struct, so
+  a move is one syscall with no text to build or parse. The text
+  protocol keeps working alongside it on the same file, but an ioctl
+  leaves no text response for read().
+
+  The layout of every struct is part of the ABI. Anything incompatible
+  gets a new ioctl number and bumps CHESS_ABI_VERSION, which userspace
+  should check with CHESS_IOC_VERSION before using anything else*/
+
+#ifndef CHESS_IOCTL_H
+#define CHESS_IOCTL_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+
+#define CHESS_ABI_VERSION   2
+
+
+/*a square is 0 to 63, a1 = 0, h1 = 7, a8 = 56. A piece is a colour
+  ORed with a type, 0 being an empty square*/
+#define CHESS_EMPTY     0
+#define CHESS_PAWN      1
+#define CHESS_KNIGHT    2
+#define CHESS_BISHOP    3
+#define CHESS_ROOK      4
+#define CHESS_QUEEN     5
+#define CHESS_KING      6
+
+#define CHESS_WHITE     0x08
+#define CHESS_BLACK     0x10
+
+
+//result codes, one for each text protocol response
+#define CHESS_OK        0
+#define CHESS_UNKCMD    1
+#define CHESS_INVFMT    2
+#define CHESS_CHECK     3
+#define CHESS_MATE      4
+#define CHESS_ILLMOVE   5
+#define CHESS_OOT       6
+#define CHESS_NOGAME    7
+#define CHESS_TIE       8
+
+
+//CHESS_IOC_NEW_GAME: color is the human's colour, like "00 W" / "00 B"
+struct chess_new_game {
+    __u8 color;
+    __u8 pad[3];
+    __s32 result;
+};
+
+
+/*CHESS_IOC_MOVE: the human's move, like "02". promo is the type a pawn
+  promotes to, or CHESS_EMPTY. A capture is a move onto an opponent's piece.
+
+  CHESS_IOC_COMPUTER_MOVE: like "03", fills in the move the computer made*/
+struct chess_move {
+    __u8 from;
+    __u8 to;
+    __u8 promo;
+    __u8 pad;
+    __s32 result;
+};
+
+
+//the deepest search depth "05 D<depth>" takes, the module's MAX_DEPTH
+#define CHESS_MAX_DEPTH         16
+
+
+/*CHESS_IOC_SEARCH (version 2): like "03 T<ms>" or "03 N<nodes>", the
+  computer's move searched for at most ms milliseconds and node_limit
+  nodes, either 0 for the session's own limits. Comes back with the
+  move, the depth of the deepest iteration the search completed, and
+  the nodes and nanoseconds it took*/
+struct chess_search {
+    __u8 from;
+    __u8 to;
+    __u8 promo;
+    __u8 depth;
+    __s32 result;
+    __u32 ms;
+    __u32 pad;
+    __u64 node_limit;
+    __u64 nodes;
+    __u64 ns;
+};
+
+
+//CHESS_IOC_BOARD: like "01", one piece byte per square and the side to move
+struct chess_board {
+    __u8 squares[64];
+    __u8 turn;
+    __u8 pad[3];
+    __s32 result;
+};
+
+
+/*CHESS_IOC_PERFT: like "06", counts the leaf nodes depth plies below fen,
+  or below the starting position if fen is "". Only the placement and the
+  side to move are read, castling and en passant are not part of the game.
+  If moves points at an array of nmoves entries, it gets the count below
+  each root move and nmoves is set to how many were filled in*/
+#define CHESS_PERFT_MAX_DEPTH   10
+#define CHESS_FEN_MAX           96
+
+struct chess_perft_move {
+    __u8 from;
+    __u8 to;
+    __u8 promo;
+    __u8 pad[5];
+    __u64 nodes;
+};
+
+struct chess_perft {
+    __u8 depth;
+    __u8 pad[3];
+    __s32 result;
+    char fen[CHESS_FEN_MAX];
+    __u64 nodes;
+    __u64 ns;
+    __u64 nps;
+    __u64 moves;        //userspace pointer to struct chess_perft_move[], or 0
+    __u32 nmoves;
+    __u32 pad2;
+};
+
+
+/*the page mmap() of /dev/chess maps read only, so a game can be watched
+  with no syscalls at all. The module makes seq odd before it changes
+  anything and even again once it is done, seqlock style: load seq, read
+  barrier, copy the fields, read barrier, and retry if seq was odd or
+  has changed since. Offset 0, one page, PROT_READ only*/
+struct chess_state {
+    __u32 seq;
+    __u32 games;        //games started on this file, 0 before the first
+    __u32 moves;
+    __u8 squares[64];
+    __u8 turn;          //side to move
+    __u8 human;         //the human's colour
+    __u8 thinking;      //1 while a computer move is being searched
+    __u8 pad;
+    __u8 last_from;     //the computer's last move, all 0 if none yet
+    __u8 last_to;
+    __u8 last_promo;
+    __u8 pad2;
+    __s32 result;       //result code of the last command
+};
+
+
+#define CHESS_IOC_MAGIC     'C'
+
+#define CHESS_IOC_VERSION           _IOR(CHESS_IOC_MAGIC, 0, __u32)
+#define CHESS_IOC_NEW_GAME          _IOWR(CHESS_IOC_MAGIC, 1, struct chess_new_game)
+#define CHESS_IOC_MOVE              _IOWR(CHESS_IOC_MAGIC, 2, struct chess_move)
+#define CHESS_IOC_COMPUTER_MOVE     _IOWR(CHESS_IOC_MAGIC, 3, struct chess_move)
+#define CHESS_IOC_BOARD             _IOR(CHESS_IOC_MAGIC, 4, struct chess_board)
+#define CHESS_IOC_PERFT             _IOWR(CHESS_IOC_MAGIC, 5, struct chess_perft)
+#define CHESS_IOC_SEARCH            _IOWR(CHESS_IOC_MAGIC, 6, struct chess_search)
+
+#endif
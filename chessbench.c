@@ -0,0 +1,751 @@
+/*userspace benchmark and perft checker for the engine core.
+
+  It builds chess_engine.h on its own, without the module or any kernel
+  headers, so move generation and search can be timed, profiled with
+  perf or run under valgrind anywhere, CI included. A fen is the first
+  two fields of a FEN string, placement and side to move, quoted or not,
+  and defaults to the starting position.
+
+  usage: chessbench perft <depth> [fen]    leaf nodes, time and nodes per second
+         chessbench divide <depth> [fen]   the same, split by root move
+         chessbench search <depth> [fen]   one search, best move and nodes per second
+         chessbench search -t <threads> <depth> [fen]
+                                           Lazy SMP with 1 to threads threads, nodes per second of each
+         chessbench selective <depth> [fen] nodes to depth without each pruning technique
+         chessbench eval <depth> [fen]     cost of the evaluation per node
+         chessbench verify                 perft of known positions and inCheck() against
+                                           mailboxCheck() over them, exits 1 on a mismatch
+         chessbench suite [nodes]          tactical positions searched on a node budget,
+                                           exits 1 unless all are solved*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "chess_engine.h"
+
+
+//transposition table size of a search, the module's default
+#define BENCH_TT_MB     16
+
+#define FEN_MAX         128
+
+//how deep verify compares inCheck() with mailboxCheck()
+#define CHECK_DEPTH     4
+
+
+/*positions with a known leaf count. The generator has no castling or en
+  passant, so either none can happen within the depth, or they happen
+  only on the last ply and the published count is taken less them*/
+static const struct {
+    const char *fen;
+    unsigned int depth;
+    unsigned long long nodes;
+} known[] = {
+    {"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w", 1, 20},
+    {"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w", 2, 400},
+    {"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w", 3, 8902},
+    {"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w", 4, 197281},
+
+    //4865609 less its 258 en passant captures
+    {"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w", 5, 4865351},
+
+    {"8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w", 1, 14},
+    {"8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w", 2, 191},
+
+    //2812 less its 2 en passant captures
+    {"8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w", 3, 2810},
+
+    //promotions, under promotions, discovered checks, mates and stalemates
+    {"2K2r2/4P3/8/8/8/8/8/3k4 w", 6, 3821001},
+    {"8/8/1P2K3/8/2n5/1q6/8/5k2 b", 5, 1004658},
+    {"4k3/1P6/8/8/8/8/K7/8 w", 6, 217342},
+    {"8/P1k5/K7/8/8/8/8/8 w", 6, 92683},
+    {"K1k5/8/P7/8/8/8/8/8 w", 6, 2217},
+    {"8/k1P5/8/1K6/8/8/8/8 w", 7, 567584},
+    {"8/8/2k5/5q2/5n2/8/5K2/8 b", 4, 23527},
+};
+
+
+/*tactical positions, each with the move to find or, avoid set, the one
+  not to play. Most are lost or won at the horizon of a fixed depth
+  search, a piece left hanging or grabbed where it is defended*/
+static const struct {
+    const char *fen;
+    const char *move;
+    bool avoid;
+} tactics[] = {
+    //free material, and material that only looks free
+    {"r3k3/8/8/8/8/8/8/R3K3 w", "a1-a8", false},
+    {"4k3/8/8/3n4/4P3/8/8/4K3 w", "e4-d5", false},
+    {"4k3/8/2n5/8/3p4/8/8/3QK3 w", "d1-d4", true},
+    {"4k3/8/4p3/3p4/8/8/8/3QK3 w", "d1-d5", true},
+    {"3rk3/8/8/3p4/8/8/3Q4/4K3 w", "d2-d5", true},
+    {"4k3/8/2p5/3b4/8/8/3R4/3RK3 w", "d2-d5", true},
+    {"4k3/8/4p3/3p4/8/4N3/8/4K3 w", "e3-d5", true},
+    {"rnb1kbnr/ppp1pppp/8/3q4/8/2N5/PPPP1PPP/R1BQKBNR b", "d5-a2", true},
+    {"r1b1kbnr/pppp1ppp/2n5/4p1q1/2B1P3/5N2/PPPP1PPP/RNBQK2R w", "f3-g5", false},
+
+    //forks and promotions
+    {"q3k3/8/8/1N6/8/8/8/4K3 w", "b5-c7", false},
+    {"4k3/8/8/8/3n4/8/8/Q3K3 b", "d4-c2", false},
+    {"8/P6k/8/8/8/8/8/K7 w", "a7-a8Q", false},
+
+    //mates
+    {"6k1/5ppp/8/8/8/8/8/R5K1 w", "a1-a8", false},
+    {"3r2k1/5ppp/8/8/8/8/5PPP/6K1 b", "d8-d1", false},
+};
+
+#define SUITE_NODES     200000
+
+
+//what walk() does at each node, see runEval()
+enum walk { WALK_MOVES, WALK_EVAL, WALK_SCRATCH };
+
+
+static const char type_chars[7] = {'*', 'P', 'N', 'B', 'R', 'Q', 'K'};
+
+static struct search search;
+
+//buckets in the transposition table, see ttAlloc()
+static unsigned long tt_buckets;
+
+//walk()'s scores end up here, so the evaluations can't be optimized out
+static volatile int sink;
+
+
+
+static unsigned long long nanoseconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+
+//same notation as the module's perft divide, e7-e8Q for a promotion
+static void formatMove(char *buf, u16 move)
+{
+    sprintf(buf, "%c%c-%c%c%.*s", 'a' + (MOVE_FROM(move) & 7), '1' + (MOVE_FROM(move) >> 3),
+            'a' + (MOVE_TO(move) & 7), '1' + (MOVE_TO(move) >> 3),
+            MOVE_PROMO(move) != EMPTY, &type_chars[MOVE_PROMO(move)]);
+}
+
+
+static void printMove(u16 move)
+{
+    char buf[8];
+
+    formatMove(buf, move);
+    printf("%s", buf);
+}
+
+
+
+static unsigned long long perftNodes(struct search *s, unsigned int depth)
+{
+    unsigned long long nodes = 0;
+    int n, k;
+
+    n = perftDivide(s, depth);
+
+    for (k = 0; k < n; k++){
+        nodes += s->divide[k];
+    }
+
+    return nodes;
+}
+
+
+
+static int runPerft(const char *fen, unsigned int depth, bool divide)
+{
+    unsigned long long nodes = 0, ns;
+    int n, k;
+
+    if (!parseFen(fen, &search.pos, &search.side)){
+        fprintf(stderr, "bad fen: %s\n", fen);
+        return 1;
+    }
+
+    ns = nanoseconds();
+    n = perftDivide(&search, depth);
+    ns = nanoseconds() - ns;
+
+    for (k = 0; k < n; k++){
+        nodes += search.divide[k];
+
+        if (divide){
+            printMove(search.moves[0][k]);
+            printf(" %llu\n", (unsigned long long) search.divide[k]);
+        }
+    }
+
+    printf("NODES %llu NS %llu NPS %llu\n", nodes, ns, nodes * 1000000000ULL / (ns ? ns : 1));
+
+    return 0;
+}
+
+
+
+//allocates the transposition table every search uses
+static bool ttAlloc(void)
+{
+    tt_buckets = BENCH_TT_MB * 1024UL * 1024 / sizeof(struct tt_bucket);
+    tt = aligned_alloc(sizeof(struct tt_bucket), tt_buckets * sizeof(struct tt_bucket));
+
+    if (tt == NULL){
+        perror("transposition table");
+        return false;
+    }
+
+    tt_mask = tt_buckets - 1;
+
+    return true;
+}
+
+
+/*searches the position in search up to depth, on budget nodes if not 0,
+  starting from nothing as a fresh session would*/
+static u16 searchFresh(unsigned int depth, unsigned long long budget, unsigned int features)
+{
+    memset(tt, 0, tt_buckets * sizeof(struct tt_bucket));
+    memset(search.history, 0, sizeof(search.history));
+
+    search.main = &search;
+    search.finished = false;
+    search.start_depth = 1;
+    search.max_depth = depth;
+    search.node_limit = budget;
+    search.features = features;
+    search.age = 1;
+
+    return think(&search);
+}
+
+
+
+static int runSearch(const char *fen, unsigned int depth)
+{
+    unsigned long long ns;
+    u16 move;
+
+    if (!parseFen(fen, &search.pos, &search.side)){
+        fprintf(stderr, "bad fen: %s\n", fen);
+        return 1;
+    }
+
+    if (!ttAlloc()){
+        return 1;
+    }
+
+    ns = nanoseconds();
+    move = searchFresh(depth, 0, SEARCH_ALL);
+    ns = nanoseconds() - ns;
+
+    printf("BEST ");
+
+    if (move == MOVE_NONE){
+        printf("none");
+    }
+
+    else{
+        printMove(move);
+    }
+
+    printf(" SCORE %d DEPTH %u NODES %llu NS %llu NPS %llu\n", search.score, search.depth_done,
+           (unsigned long long) search.nodes, ns, search.nodes * 1000000000ULL / (ns ? ns : 1));
+
+    printf("QNODES %llu\n", (unsigned long long) search.qnodes);
+
+    printf("TT probes %llu hits %llu collisions %llu\n", (unsigned long long) search.tt_probes,
+           (unsigned long long) search.tt_hits, (unsigned long long) search.tt_collisions);
+
+    printf("CUTOFFS %llu first move %llu (%llu%%)\n", (unsigned long long) search.cutoffs,
+           (unsigned long long) search.first_cutoffs,
+           search.first_cutoffs * 100ULL / (search.cutoffs ? search.cutoffs : 1));
+
+    free(tt);
+
+    return 0;
+}
+
+
+//a Lazy SMP helper, the thread the module would run on search_wq
+static void *helperThread(void *arg)
+{
+    think(arg);
+
+    return NULL;
+}
+
+
+/*searchFresh() with nthreads threads, Lazy SMP the way the module's
+  smpSearch() runs it: helpers in team[1] and up search the root of team[0]
+  over the shared transposition table, the odd ones a ply deeper, until
+  the main search is done. Returns the move of the deepest iteration any
+  of them completed*/
+static u16 smpFresh(struct search *team, unsigned int nthreads, unsigned int depth)
+{
+    pthread_t threads[MAX_THREADS];
+    struct search *s = &team[0];
+    unsigned int k, done;
+    u16 best;
+
+    memset(tt, 0, tt_buckets * sizeof(struct tt_bucket));
+
+    s->main = s;
+    s->finished = false;
+    s->start_depth = 1;
+    s->max_depth = depth;
+    s->node_limit = 0;
+    s->features = SEARCH_ALL;
+    s->age = 1;
+
+    for (k = 1; k < nthreads; k++){
+        struct search *h = &team[k];
+
+        h->pos = s->pos;
+        h->side = s->side;
+        h->age = s->age;
+        h->max_depth = depth;
+        h->node_limit = 0;
+        h->features = s->features;
+        h->main = s;
+        h->start_depth = (1 + (k & 1) < depth) ? 1 + (k & 1) : depth;
+
+        pthread_create(&threads[k], NULL, helperThread, h);
+    }
+
+    think(s);
+
+    __atomic_store_n(&s->finished, true, __ATOMIC_RELAXED);
+
+    best = s->best;
+    done = s->depth_done;
+
+    for (k = 1; k < nthreads; k++){
+        pthread_join(threads[k], NULL);
+
+        if (team[k].best != MOVE_NONE && team[k].depth_done > done){
+            best = team[k].best;
+            done = team[k].depth_done;
+        }
+    }
+
+    s->depth_done = done;
+
+    return best;
+}
+
+
+/*the same search with 1 to nthreads threads, each from a fresh table,
+  and the nodes all the threads searched per second. Lazy SMP mostly
+  buys depth sooner, so the time to depth matters as much as the NPS*/
+static int runSmp(const char *fen, unsigned int depth, unsigned int nthreads)
+{
+    struct search *team;
+    unsigned long long ns, nodes;
+    unsigned int t, k;
+    char played[8];
+    u16 move;
+
+    team = calloc(nthreads, sizeof(*team));
+
+    if (team == NULL){
+        perror("search contexts");
+        return 1;
+    }
+
+    if (!ttAlloc()){
+        free(team);
+        return 1;
+    }
+
+    for (t = 1; t <= nthreads; t++){
+        memset(team, 0, nthreads * sizeof(*team));
+
+        if (!parseFen(fen, &team[0].pos, &team[0].side)){
+            fprintf(stderr, "bad fen: %s\n", fen);
+            free(team);
+            free(tt);
+            return 1;
+        }
+
+        ns = nanoseconds();
+        move = smpFresh(team, t, depth);
+        ns = nanoseconds() - ns;
+
+        nodes = 0;
+
+        for (k = 0; k < t; k++){
+            nodes += team[k].nodes;
+        }
+
+        formatMove(played, move);
+
+        printf("THREADS %2u BEST %-7s DEPTH %2u NODES %12llu NS %12llu NPS %10llu\n", t,
+               (move == MOVE_NONE) ? "none" : played, team[0].depth_done, nodes, ns,
+               nodes * 1000000000ULL / (ns ? ns : 1));
+    }
+
+    free(team);
+    free(tt);
+
+    return 0;
+}
+
+
+/*the same search with every selective technique, with each of them left
+  out in turn and with none, and the nodes each took to reach depth*/
+static int runSelective(const char *fen, unsigned int depth)
+{
+    static const struct {
+        const char *name;
+        unsigned int features;
+    } rows[] = {
+        {"all", SEARCH_ALL},
+        {"no null move", SEARCH_ALL & ~SEARCH_NULL_MOVE},
+        {"no lmr", SEARCH_ALL & ~SEARCH_LMR},
+        {"no futility", SEARCH_ALL & ~SEARCH_FUTILITY},
+        {"no pvs", SEARCH_ALL & ~SEARCH_PVS},
+        {"no aspiration", SEARCH_ALL & ~SEARCH_ASPIRATION},
+        {"none", 0},
+    };
+
+    unsigned long long ns;
+    unsigned int k;
+    char played[8];
+
+    if (!ttAlloc()){
+        return 1;
+    }
+
+    for (k = 0; k < sizeof(rows) / sizeof(rows[0]); k++){
+        if (!parseFen(fen, &search.pos, &search.side)){
+            fprintf(stderr, "bad fen: %s\n", fen);
+            free(tt);
+            return 1;
+        }
+
+        ns = nanoseconds();
+        formatMove(played, searchFresh(depth, 0, rows[k].features));
+        ns = nanoseconds() - ns;
+
+        printf("%-14s BEST %-7s SCORE %6d NODES %12llu NS %12llu\n", rows[k].name, played,
+               search.score, (unsigned long long) search.nodes, ns);
+    }
+
+    free(tt);
+
+    return 0;
+}
+
+
+
+/*visits every node depth plies below the position in s and returns
+  how many. Each is evaluated the way the search does with WALK_EVAL,
+  and with WALK_SCRATCH the terms are first counted up from the 64
+  squares, which is what evaluate() would cost without them kept
+  incrementally*/
+static unsigned long long walk(struct search *s, unsigned int depth, enum walk how)
+{
+    u16 *moves = s->moves[s->ply];
+    unsigned long long nodes = 1;
+    int n, k;
+
+    if (how == WALK_EVAL){
+        sink = evaluate(s);
+    }
+
+    else if (how == WALK_SCRATCH){
+        positionScore(&s->pos);
+        sink = evaluate(s);
+    }
+
+    if (depth == 0){
+        return 1;
+    }
+
+    n = generateMoves(&s->pos, s->side, moves);
+
+    for (k = 0; k < n; k++){
+        makeMove(s, moves[k]);
+        nodes += walk(s, depth - 1, how);
+        unmakeMove(s, moves[k]);
+    }
+
+    return nodes;
+}
+
+
+/*the same tree is walked without evaluating, evaluating, and
+  evaluating from scratch, and the differences are the cost per node*/
+static int runEval(const char *fen, unsigned int depth)
+{
+    static const char *names[3] = {"moves only", "evaluate", "from scratch"};
+
+    unsigned long long nodes = 0, ns[3];
+    int how;
+
+    if (!parseFen(fen, &search.pos, &search.side)){
+        fprintf(stderr, "bad fen: %s\n", fen);
+        return 1;
+    }
+
+    for (how = WALK_MOVES; how <= WALK_SCRATCH; how++){
+        search.ply = 0;
+
+        ns[how] = nanoseconds();
+        nodes = walk(&search, depth, how);
+        ns[how] = nanoseconds() - ns[how];
+    }
+
+    printf("NODES %llu\n", nodes);
+
+    for (how = WALK_MOVES; how <= WALK_SCRATCH; how++){
+        long long extra = (long long) (ns[how] - ns[WALK_MOVES]);
+
+        printf("%-12s NS %llu, %.2f ns per node", names[how], ns[how], (double) ns[how] / nodes);
+
+        if (how != WALK_MOVES){
+            printf(", %.2f ns per evaluation", (double) extra / nodes);
+        }
+
+        printf("\n");
+    }
+
+    return 0;
+}
+
+
+
+/*counts the nodes depth plies below the position in s where inCheck()
+  and mailboxCheck() disagree about either side*/
+static unsigned long long checkMismatches(struct search *s, unsigned int depth)
+{
+    u16 *moves = s->moves[s->ply];
+    unsigned long long bad = 0;
+    int n, k;
+
+    bad += inCheck(&s->pos, WHITE) != mailboxCheck(&s->pos, WHITE);
+    bad += inCheck(&s->pos, BLACK) != mailboxCheck(&s->pos, BLACK);
+
+    if (depth == 0){
+        return bad;
+    }
+
+    n = generateMoves(&s->pos, s->side, moves);
+
+    for (k = 0; k < n; k++){
+        makeMove(s, moves[k]);
+        bad += checkMismatches(s, depth - 1);
+        unmakeMove(s, moves[k]);
+    }
+
+    return bad;
+}
+
+
+
+/*the perft counts, then the module's two in-check tests held to each
+  other over the same positions, at most CHECK_DEPTH plies down*/
+static int runVerify(void)
+{
+    unsigned long long nodes;
+    unsigned int k, depth;
+    int failed = 0;
+
+    for (k = 0; k < sizeof(known) / sizeof(known[0]); k++){
+        if (!parseFen(known[k].fen, &search.pos, &search.side)){
+            printf("FAIL %s: bad fen\n", known[k].fen);
+            failed++;
+            continue;
+        }
+
+        nodes = perftNodes(&search, known[k].depth);
+
+        printf("%s %s depth %u: %llu", (nodes == known[k].nodes) ? "ok  " : "FAIL",
+               known[k].fen, known[k].depth, nodes);
+
+        if (nodes != known[k].nodes){
+            printf(", expected %llu", known[k].nodes);
+            failed++;
+        }
+
+        printf("\n");
+    }
+
+    for (k = 0; k < sizeof(known) / sizeof(known[0]); k++){
+        if (!parseFen(known[k].fen, &search.pos, &search.side)){
+            continue;
+        }
+
+        depth = (known[k].depth < CHECK_DEPTH) ? known[k].depth : CHECK_DEPTH;
+        search.ply = 0;
+        nodes = checkMismatches(&search, depth);
+
+        printf("%s %s depth %u: %llu in-check mismatches\n", (nodes == 0) ? "ok  " : "FAIL",
+               known[k].fen, depth, nodes);
+
+        failed += nodes != 0;
+    }
+
+    printf("%d of %u failed\n", failed, 2 * k);
+
+    return failed != 0;
+}
+
+
+
+/*every tactic searched on the same node budget, how many are solved
+  being the measure of how well the search spends its nodes*/
+static int runSuite(unsigned long long budget)
+{
+    unsigned long long nodes = 0, ns;
+    unsigned int k;
+    int solved = 0;
+    char played[8];
+    bool ok;
+
+    if (!ttAlloc()){
+        return 1;
+    }
+
+    ns = nanoseconds();
+
+    for (k = 0; k < sizeof(tactics) / sizeof(tactics[0]); k++){
+        if (!parseFen(tactics[k].fen, &search.pos, &search.side)){
+            printf("FAIL %s: bad fen\n", tactics[k].fen);
+            continue;
+        }
+
+        formatMove(played, searchFresh(MAX_DEPTH, budget, SEARCH_ALL));
+        nodes += search.nodes;
+
+        ok = (strcmp(played, tactics[k].move) == 0) != tactics[k].avoid;
+        solved += ok;
+
+        printf("%s %s %s %s: %s depth %u\n", ok ? "ok  " : "FAIL", tactics[k].fen,
+               tactics[k].avoid ? "avoid" : "best", tactics[k].move, played, search.depth_done);
+    }
+
+    ns = nanoseconds() - ns;
+
+    printf("%d of %u solved, NODES %llu NS %llu\n", solved, k, nodes, ns);
+
+    free(tt);
+
+    return (unsigned int) solved < k;
+}
+
+
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s perft|divide|search|selective|eval <depth> [fen]\n"
+                    "       %s search -t <threads> <depth> [fen]\n"
+                    "       %s verify\n"
+                    "       %s suite [nodes]\n", name, name, name, name);
+    exit(1);
+}
+
+
+
+int main(int argc, char **argv)
+{
+    char fen[FEN_MAX];
+    unsigned int depth;
+    unsigned int threads = 0;
+    int arg = 2;
+    int k;
+
+    if (argc == 2 && strcmp(argv[1], "verify") == 0){
+        return runVerify();
+    }
+
+    if (argc <= 3 && argc >= 2 && strcmp(argv[1], "suite") == 0){
+        return runSuite((argc == 3) ? strtoull(argv[2], NULL, 10) : SUITE_NODES);
+    }
+
+    //"search -t <threads>", the depth and fen follow as usual
+    if (argc >= 3 && strcmp(argv[1], "search") == 0 && strcmp(argv[2], "-t") == 0){
+        threads = (argc >= 4) ? atoi(argv[3]) : 0;
+        arg = 4;
+
+        if (threads < 1 || threads > MAX_THREADS){
+            fprintf(stderr, "threads must be 1 to %d\n", MAX_THREADS);
+            return 1;
+        }
+    }
+
+    if (argc <= arg){
+        usage(argv[0]);
+    }
+
+    depth = atoi(argv[arg]);
+
+    //the fen may come as one quoted argument or as several
+    strcpy(fen, start_fen);
+
+    if (argc > arg + 1){
+        fen[0] = '\0';
+
+        for (k = arg + 1; k < argc; k++){
+            if (strlen(fen) + strlen(argv[k]) + 2 > sizeof(fen)){
+                fprintf(stderr, "fen too long\n");
+                return 1;
+            }
+
+            if (k > arg + 1){
+                strcat(fen, " ");
+            }
+
+            strcat(fen, argv[k]);
+        }
+    }
+
+    if (strcmp(argv[1], "search") == 0){
+        if (depth < 1 || depth > MAX_DEPTH){
+            fprintf(stderr, "depth must be 1 to %d\n", MAX_DEPTH);
+            return 1;
+        }
+
+        return threads ? runSmp(fen, depth, threads) : runSearch(fen, depth);
+    }
+
+    if (strcmp(argv[1], "selective") == 0){
+        if (depth < 1 || depth > MAX_DEPTH){
+            fprintf(stderr, "depth must be 1 to %d\n", MAX_DEPTH);
+            return 1;
+        }
+
+        return runSelective(fen, depth);
+    }
+
+    if (depth < 1 || depth >= MAX_PLY){
+        fprintf(stderr, "depth must be 1 to %d\n", MAX_PLY - 1);
+        return 1;
+    }
+
+    if (strcmp(argv[1], "perft") == 0){
+        return runPerft(fen, depth, false);
+    }
+
+    if (strcmp(argv[1], "divide") == 0){
+        return runPerft(fen, depth, true);
+    }
+
+    if (strcmp(argv[1], "eval") == 0){
+        return runEval(fen, depth);
+    }
+
+    usage(argv[0]);
+
+    return 1;
+}
@@ -0,0 +1,219 @@
+/*reader contention benchmark for /dev/chess.
+
+  One writer thread keeps starting a game and making the same opening
+  move on one open file, while N reader threads fetch the board from
+  that same file as fast as they can for a fixed time. Run it against
+  two builds of the module to compare how reader throughput holds up
+  with the writer going, e.g. before and after a locking change.
+
+  Readers use CHESS_IOC_BOARD by default, the "01" text command with -t,
+  or the mmap() state page with -m, which takes no syscalls at all.
+
+  usage: chesscontend [-r readers] [-s seconds] [-t | -m]*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include "chess_ioctl.h"
+
+
+#define MAX_READERS 256
+
+enum mode { MODE_IOCTL, MODE_TEXT, MODE_MMAP };
+
+
+static int fd;
+static enum mode mode = MODE_IOCTL;
+static const struct chess_state *state;
+
+static int stop;
+
+//one counter per thread, padded so the counting itself never contends
+struct counter {
+    unsigned long long n;
+    char pad[56];
+};
+
+static struct counter reads[MAX_READERS];
+static struct counter writes;
+
+
+
+static int stopped(void)
+{
+    return __atomic_load_n(&stop, __ATOMIC_RELAXED);
+}
+
+
+
+static void *writer(void *arg)
+{
+    struct chess_new_game game;
+    struct chess_move move;
+
+    (void) arg;
+
+    while (!stopped()){
+        memset(&game, 0, sizeof(game));
+        game.color = CHESS_WHITE;
+
+        if (ioctl(fd, CHESS_IOC_NEW_GAME, &game) < 0){
+            perror("CHESS_IOC_NEW_GAME");
+            exit(1);
+        }
+
+        //e2-e4
+        memset(&move, 0, sizeof(move));
+        move.from = 12;
+        move.to = 28;
+
+        if (ioctl(fd, CHESS_IOC_MOVE, &move) < 0){
+            perror("CHESS_IOC_MOVE");
+            exit(1);
+        }
+
+        writes.n += 2;
+    }
+
+    return NULL;
+}
+
+
+
+//one consistent copy of the board out of the state page
+static void readState(struct chess_board *board)
+{
+    unsigned int seq;
+
+    do {
+        seq = __atomic_load_n(&state->seq, __ATOMIC_ACQUIRE);
+
+        memcpy(board->squares, state->squares, sizeof(board->squares));
+        board->turn = state->turn;
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    } while ((seq & 1) || seq != __atomic_load_n(&state->seq, __ATOMIC_RELAXED));
+}
+
+
+
+static void *reader(void *arg)
+{
+    struct counter *count = arg;
+    struct chess_board board;
+    char buf[256];
+
+    while (!stopped()){
+
+        if (mode == MODE_IOCTL){
+            if (ioctl(fd, CHESS_IOC_BOARD, &board) < 0){
+                perror("CHESS_IOC_BOARD");
+                exit(1);
+            }
+        }
+
+        /*the response ring is shared by every text reader on the file, so
+          this may read another reader's board, part of one or nothing,
+          it is the same amount of work. The writer's ioctls queue nothing*/
+        else if (mode == MODE_TEXT){
+            if (write(fd, "01\n", 3) != 3 || read(fd, buf, sizeof(buf)) < 0){
+                perror("01");
+                exit(1);
+            }
+        }
+
+        else{
+            readState(&board);
+        }
+
+        count->n++;
+    }
+
+    return NULL;
+}
+
+
+
+int main(int argc, char **argv)
+{
+    static const char *names[] = {"ioctl", "text", "mmap"};
+
+    pthread_t threads[MAX_READERS + 1];
+    unsigned long long total = 0;
+    int nreaders = 4;
+    int seconds = 5;
+    int opt, k;
+
+    while ((opt = getopt(argc, argv, "r:s:tm")) != -1){
+        switch (opt){
+        case 'r':
+            nreaders = atoi(optarg);
+            break;
+        case 's':
+            seconds = atoi(optarg);
+            break;
+        case 't':
+            mode = MODE_TEXT;
+            break;
+        case 'm':
+            mode = MODE_MMAP;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-r readers] [-s seconds] [-t | -m]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (nreaders < 1 || nreaders > MAX_READERS || seconds < 1){
+        fprintf(stderr, "readers must be 1 to %d and seconds at least 1\n", MAX_READERS);
+        return 1;
+    }
+
+    fd = open("/dev/chess", O_RDWR);
+
+    if (fd < 0){
+        perror("/dev/chess");
+        return 1;
+    }
+
+    if (mode == MODE_MMAP){
+        state = mmap(NULL, sizeof(*state), PROT_READ, MAP_SHARED, fd, 0);
+
+        if (state == MAP_FAILED){
+            perror("mmap");
+            return 1;
+        }
+    }
+
+    for (k = 0; k < nreaders; k++){
+        pthread_create(&threads[k], NULL, reader, &reads[k]);
+    }
+
+    pthread_create(&threads[nreaders], NULL, writer, NULL);
+
+    sleep(seconds);
+    __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+
+    for (k = 0; k <= nreaders; k++){
+        pthread_join(threads[k], NULL);
+    }
+
+    for (k = 0; k < nreaders; k++){
+        total += reads[k].n;
+    }
+
+    printf("%s readers %d: %llu reads/s (%llu per reader), writer %llu commands/s\n",
+           names[mode], nreaders, total / seconds, total / seconds / nreaders, writes.n / seconds);
+
+    close(fd);
+
+    return 0;
+}
@@ -0,0 +1,778 @@
+/*multi-client load generator and latency benchmark for /dev/chess.
+
+  Each client thread opens its own session and plays games over and
+  over for a fixed time. It starts a game as white ("00"), fetches the
+  board ("01"), plays a random legal move ("02"), lets the computer
+  answer ("03"), and repeats until the game is over or has gone on for
+  the move limit. Every command is timed, and at the end the rate of
+  commands and the p50/p99/p999 latency of each kind are printed.
+
+  The moves come from the engine core in chess_engine.h, seeded by the
+  client number, so a run plays the same games every time. Clients talk
+  the text protocol by default or the ioctls with -i. With -u they skip
+  the device and drive the engine core in process, which gives the same
+  numbers without the kernel in the way. With -t every computer move
+  gets a time budget, "03 T<ms>" or CHESS_IOC_SEARCH, to check that its
+  latency stays within it under load.
+
+  With -r it times nothing and instead checks the response ring of one
+  session: end of file, partial reads, and a writer held up rather than
+  losing responses when its reader falls behind.
+
+  usage: chessload [-c clients] [-s seconds] [-d depth] [-t ms] [-m moves] [-i | -u | -r]*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/ioctl.h>
+
+#include "chess_ioctl.h"
+#include "chess_engine.h"
+
+
+#define MAX_CLIENTS     256
+
+//transposition table of the in process engine, the module's default
+#define LOAD_TT_MB      16
+
+//the commands that are timed, indexed by their number
+#define NCMDS           4
+
+enum backend { BACKEND_TEXT, BACKEND_IOCTL, BACKEND_ENGINE };
+
+
+//latencies of one kind of command, in nanoseconds
+struct samples {
+    unsigned long long *ns;
+    size_t n;
+    size_t size;
+};
+
+struct client {
+    int fd;
+    unsigned long long rng;
+    unsigned long long games;
+
+    //the board as last fetched, and for -u the game itself
+    struct position pos;
+    struct search *s;
+
+    struct samples cmds[NCMDS];
+};
+
+
+static enum backend backend = BACKEND_TEXT;
+static unsigned int depth;
+static unsigned int move_ms;
+static unsigned int max_moves = 40;
+
+static int stop;
+
+static struct client clients[MAX_CLIENTS];
+
+//stamps the entries of each in process search, like the module's tt_age
+static unsigned int search_age;
+
+
+
+static int stopped(void)
+{
+    return __atomic_load_n(&stop, __ATOMIC_RELAXED);
+}
+
+
+
+static unsigned long long nanoseconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+
+static void record(struct samples *smp, unsigned long long ns)
+{
+    if (smp->n == smp->size){
+        smp->size = smp->size ? smp->size * 2 : 4096;
+        smp->ns = realloc(smp->ns, smp->size * sizeof(*smp->ns));
+
+        if (smp->ns == NULL){
+            perror("realloc");
+            exit(1);
+        }
+    }
+
+    smp->ns[smp->n++] = ns;
+}
+
+
+
+//xorshift64, one stream per client so the games don't depend on scheduling
+static unsigned long long random64(struct client *c)
+{
+    c->rng ^= c->rng << 13;
+    c->rng ^= c->rng >> 7;
+    c->rng ^= c->rng << 17;
+
+    return c->rng;
+}
+
+
+
+
+/*the text protocol. One command is outstanding at a time, so read()
+  returns exactly its response, but a line is read to its end anyway*/
+
+static const char type_chars[7] = {'*', 'P', 'N', 'B', 'R', 'Q', 'K'};
+
+static const struct {
+    const char *text;
+    int code;
+} responses[] = {
+    {"OK\n", CHESS_OK}, {"UNKCMD\n", CHESS_UNKCMD}, {"INVFMT\n", CHESS_INVFMT},
+    {"CHECK\n", CHESS_CHECK}, {"MATE\n", CHESS_MATE}, {"ILLMOVE\n", CHESS_ILLMOVE},
+    {"OOT\n", CHESS_OOT}, {"NOGAME\n", CHESS_NOGAME}, {"TIE\n", CHESS_TIE},
+};
+
+
+static size_t textCommand(struct client *c, const char *cmd, char *buf, size_t size)
+{
+    size_t len = 0;
+    ssize_t n;
+
+    if (write(c->fd, cmd, strlen(cmd)) < 0){
+        perror(cmd);
+        exit(1);
+    }
+
+    do {
+        n = read(c->fd, buf + len, size - len - 1);
+
+        if (n <= 0){
+            perror(cmd);
+            exit(1);
+        }
+
+        len += n;
+    } while (buf[len - 1] != '\n' && len < size - 1);
+
+    buf[len] = '\0';
+
+    return len;
+}
+
+
+static int textResult(struct client *c, const char *cmd)
+{
+    char buf[64];
+    unsigned int k;
+
+    textCommand(c, cmd, buf, sizeof(buf));
+
+    for (k = 0; k < sizeof(responses) / sizeof(responses[0]); k++){
+        if (strcmp(buf, responses[k].text) == 0){
+            return responses[k].code;
+        }
+    }
+
+    fprintf(stderr, "%s: unexpected response %s", cmd, buf);
+    exit(1);
+}
+
+
+static int textNewGame(struct client *c)
+{
+    return textResult(c, "00 W\n");
+}
+
+
+static int textBoard(struct client *c, u8 squares[64])
+{
+    char buf[256];
+    int sq;
+
+    if (textCommand(c, "01\n", buf, sizeof(buf)) != 129){
+        return CHESS_NOGAME;
+    }
+
+    for (sq = 0; sq < 64; sq++){
+        u8 color = (buf[2 * sq] == 'W') ? WHITE : (buf[2 * sq] == 'B') ? BLACK : EMPTY;
+        const char *type = memchr(type_chars, buf[2 * sq + 1], sizeof(type_chars));
+
+        squares[sq] = (color && type) ? color | (type - type_chars) : EMPTY;
+    }
+
+    return CHESS_OK;
+}
+
+
+//"02 WPe2-e4", then "xBP" for a capture and "yWQ" for a promotion
+static int textMove(struct client *c, u16 move)
+{
+    char cmd[32];
+    char *p = cmd;
+    u8 piece = pieceAt(&c->pos, MOVE_FROM(move));
+    u8 captured = pieceAt(&c->pos, MOVE_TO(move));
+
+    p += sprintf(p, "02 W%c%c%c-%c%c", type_chars[PIECE_TYPE(piece)],
+                 'a' + (MOVE_FROM(move) & 7), '1' + (MOVE_FROM(move) >> 3),
+                 'a' + (MOVE_TO(move) & 7), '1' + (MOVE_TO(move) >> 3));
+
+    if (captured != EMPTY){
+        p += sprintf(p, "xB%c", type_chars[PIECE_TYPE(captured)]);
+    }
+
+    if (MOVE_PROMO(move) != EMPTY){
+        p += sprintf(p, "yW%c", type_chars[MOVE_PROMO(move)]);
+    }
+
+    strcpy(p, "\n");
+
+    return textResult(c, cmd);
+}
+
+
+static int textComputerMove(struct client *c)
+{
+    char cmd[16];
+
+    if (move_ms){
+        snprintf(cmd, sizeof(cmd), "03 T%u\n", move_ms);
+        return textResult(c, cmd);
+    }
+
+    return textResult(c, "03\n");
+}
+
+
+
+
+//the ioctls, one syscall a command and nothing to format or parse
+
+static int ioctlNewGame(struct client *c)
+{
+    struct chess_new_game game;
+
+    memset(&game, 0, sizeof(game));
+    game.color = CHESS_WHITE;
+
+    if (ioctl(c->fd, CHESS_IOC_NEW_GAME, &game) < 0){
+        perror("CHESS_IOC_NEW_GAME");
+        exit(1);
+    }
+
+    return game.result;
+}
+
+
+static int ioctlBoard(struct client *c, u8 squares[64])
+{
+    struct chess_board board;
+
+    if (ioctl(c->fd, CHESS_IOC_BOARD, &board) < 0){
+        perror("CHESS_IOC_BOARD");
+        exit(1);
+    }
+
+    memcpy(squares, board.squares, 64);
+
+    return board.result;
+}
+
+
+static int ioctlMove(struct client *c, u16 move)
+{
+    struct chess_move m;
+
+    memset(&m, 0, sizeof(m));
+    m.from = MOVE_FROM(move);
+    m.to = MOVE_TO(move);
+    m.promo = MOVE_PROMO(move);
+
+    if (ioctl(c->fd, CHESS_IOC_MOVE, &m) < 0){
+        perror("CHESS_IOC_MOVE");
+        exit(1);
+    }
+
+    return m.result;
+}
+
+
+static int ioctlComputerMove(struct client *c)
+{
+    struct chess_move m;
+    struct chess_search search;
+
+    if (move_ms){
+        memset(&search, 0, sizeof(search));
+        search.ms = move_ms;
+
+        if (ioctl(c->fd, CHESS_IOC_SEARCH, &search) < 0){
+            perror("CHESS_IOC_SEARCH");
+            exit(1);
+        }
+
+        return search.result;
+    }
+
+    memset(&m, 0, sizeof(m));
+
+    if (ioctl(c->fd, CHESS_IOC_COMPUTER_MOVE, &m) < 0){
+        perror("CHESS_IOC_COMPUTER_MOVE");
+        exit(1);
+    }
+
+    return m.result;
+}
+
+
+
+
+/*the engine core in process: the same search and move generation the
+  module runs, with the game kept in the client's own struct search*/
+
+//what the module answers after a move, seen from the side now to move
+static int engineResult(struct search *s)
+{
+    int n = generateMoves(&s->pos, s->side, s->moves[0]);
+
+    if (n == 0){
+        return inCheck(&s->pos, s->side) ? CHESS_MATE : CHESS_TIE;
+    }
+
+    return inCheck(&s->pos, s->side) ? CHESS_CHECK : CHESS_OK;
+}
+
+
+static int engineNewGame(struct client *c)
+{
+    parseFen(start_fen, &c->s->pos, &c->s->side);
+    c->s->ply = 0;
+
+    return CHESS_OK;
+}
+
+
+static int engineBoard(struct client *c, u8 squares[64])
+{
+    memcpy(squares, c->s->pos.board, 64);
+
+    return CHESS_OK;
+}
+
+
+static int engineMove(struct client *c, u16 move)
+{
+    struct search *s = c->s;
+    int n, k;
+
+    n = generateMoves(&s->pos, s->side, s->moves[0]);
+
+    for (k = 0; k < n && s->moves[0][k] != move; k++){
+    }
+
+    if (k == n){
+        return CHESS_ILLMOVE;
+    }
+
+    makeMove(s, move);
+    s->ply = 0;
+
+    return engineResult(s);
+}
+
+
+static int engineComputerMove(struct client *c)
+{
+    struct search *s = c->s;
+    u16 move;
+
+    s->main = s;
+    s->finished = false;
+    s->start_depth = 1;
+    s->max_depth = depth ? depth : 4;
+    s->node_limit = 0;
+    s->time_limit = move_ms * 1000000ULL;
+    s->features = SEARCH_ALL;
+    s->age = (u8) __atomic_add_fetch(&search_age, 1, __ATOMIC_RELAXED);
+
+    move = think(s);
+
+    if (move == MOVE_NONE){
+        return CHESS_TIE;
+    }
+
+    makeMove(s, move);
+    s->ply = 0;
+
+    return engineResult(s);
+}
+
+
+
+
+static const struct {
+    const char *name;
+    int (*newGame)(struct client *c);
+    int (*board)(struct client *c, u8 squares[64]);
+    int (*move)(struct client *c, u16 move);
+    int (*computerMove)(struct client *c);
+} backends[] = {
+    {"text", textNewGame, textBoard, textMove, textComputerMove},
+    {"ioctl", ioctlNewGame, ioctlBoard, ioctlMove, ioctlComputerMove},
+    {"engine", engineNewGame, engineBoard, engineMove, engineComputerMove},
+};
+
+
+//the result of call, with the time it took recorded as command cmd
+#define TIMED(c, cmd, call) ({                                  \
+    unsigned long long __start = nanoseconds();                 \
+    int __rv = (call);                                          \
+    record(&(c)->cmds[cmd], nanoseconds() - __start);           \
+    __rv;                                                       \
+})
+
+
+
+//one game as white against the computer, as long as the clock allows
+static void playGame(struct client *c)
+{
+    u16 moves[MAX_MOVES];
+    unsigned int k;
+    int n, rv;
+
+    if (TIMED(c, 0, backends[backend].newGame(c)) != CHESS_OK){
+        fprintf(stderr, "new game failed\n");
+        exit(1);
+    }
+
+    for (k = 0; k < max_moves && !stopped(); k++){
+        if (TIMED(c, 1, backends[backend].board(c, (u8 *) c->pos.board)) != CHESS_OK){
+            break;
+        }
+
+        syncBitboards(&c->pos);
+
+        n = generateMoves(&c->pos, WHITE, moves);
+
+        if (n == 0){
+            break;
+        }
+
+        rv = TIMED(c, 2, backends[backend].move(c, moves[random64(c) % n]));
+
+        if (rv != CHESS_OK && rv != CHESS_CHECK){
+            break;
+        }
+
+        rv = TIMED(c, 3, backends[backend].computerMove(c));
+
+        if (rv != CHESS_OK && rv != CHESS_CHECK){
+            break;
+        }
+    }
+
+    c->games++;
+}
+
+
+
+static void *client(void *arg)
+{
+    struct client *c = arg;
+
+    while (!stopped()){
+        playGame(c);
+    }
+
+    return NULL;
+}
+
+
+
+static int compare(const void *a, const void *b)
+{
+    unsigned long long x = *(const unsigned long long *) a;
+    unsigned long long y = *(const unsigned long long *) b;
+
+    return (x > y) - (x < y);
+}
+
+
+//microseconds at fraction q of the sorted samples
+static double percentile(const struct samples *smp, double q)
+{
+    size_t k = (size_t) (q * smp->n);
+
+    return smp->ns[(k < smp->n) ? k : smp->n - 1] / 1000.0;
+}
+
+
+
+static int openClient(struct client *c, unsigned int seed)
+{
+    char cmd[16];
+
+    c->rng = 0x9e3779b97f4a7c15ULL * (seed + 1);
+
+    if (backend == BACKEND_ENGINE){
+        c->s = calloc(1, sizeof(*c->s));
+
+        if (c->s == NULL){
+            perror("calloc");
+            return -1;
+        }
+
+        return 0;
+    }
+
+    c->fd = open("/dev/chess", O_RDWR);
+
+    if (c->fd < 0){
+        perror("/dev/chess");
+        return -1;
+    }
+
+    //the computer's depth is per session, there is no ioctl for it
+    if (depth){
+        snprintf(cmd, sizeof(cmd), "05 D%u\n", depth);
+
+        if (textResult(c, cmd) != CHESS_OK){
+            fprintf(stderr, "depth %u refused\n", depth);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+
+//reads one "01" response, in as many reads as it takes, into buf
+static int readBoard(int fd, char buf[129])
+{
+    size_t len = 0;
+    ssize_t n;
+
+    while (len < 129 && (n = read(fd, buf + len, 129 - len)) > 0){
+        len += n;
+    }
+
+    return len == 129 && buf[128] == '\n';
+}
+
+
+/*-r: the response ring of one non-blocking session. Nothing queued
+  reads as end of file, a response read a byte at a time comes back
+  whole, and a writer that never reads gets a short write and then
+  EAGAIN, with every response it did get still queued and in order*/
+static int checkRing(void)
+{
+    static const char batch[] = "01\n01\n01\n01\n01\n01\n01\n01\n01\n01\n";
+
+    char board[129], buf[129];
+    unsigned int queued = 0, k;
+    int failed = 0;
+    ssize_t n;
+    size_t len;
+    int fd;
+
+    fd = open("/dev/chess", O_RDWR | O_NONBLOCK);
+
+    if (fd < 0){
+        perror("/dev/chess");
+        return 1;
+    }
+
+    if (read(fd, buf, sizeof(buf)) != 0){
+        fprintf(stderr, "ring: a fresh session is not at end of file\n");
+        failed++;
+    }
+
+    if (write(fd, "00 W\n01\n", 8) != 8 || read(fd, buf, 3) != 3 || memcmp(buf, "OK\n", 3) != 0){
+        fprintf(stderr, "ring: \"00 W\" not answered with OK\n");
+        failed++;
+    }
+
+    for (len = 0; len < sizeof(board) && read(fd, board + len, 1) == 1; len++){
+    }
+
+    if (len != sizeof(board) || board[128] != '\n' || read(fd, buf, 1) != 0){
+        fprintf(stderr, "ring: the board read a byte at a time came back as %zu bytes\n", len);
+        failed++;
+    }
+
+    //never reading, a batch is cut short and then even one command waits
+    for (;;){
+        n = write(fd, batch, sizeof(batch) - 1);
+
+        if (n < 0 || n % 3 != 0){
+            break;
+        }
+
+        queued += n / 3;
+
+        if ((size_t) n < sizeof(batch) - 1){
+            break;
+        }
+    }
+
+    while ((n = write(fd, "01\n", 3)) == 3){
+        queued++;
+    }
+
+    if (n >= 0 || errno != EAGAIN){
+        fprintf(stderr, "ring: a full ring gave %zd, not EAGAIN\n", n);
+        failed++;
+    }
+
+    for (k = 0; k < queued; k++){
+        if (!readBoard(fd, buf) || memcmp(buf, board, sizeof(board)) != 0){
+            fprintf(stderr, "ring: response %u of %u lost or torn\n", k + 1, queued);
+            failed++;
+            break;
+        }
+    }
+
+    if (read(fd, buf, sizeof(buf)) != 0){
+        fprintf(stderr, "ring: more queued than was written\n");
+        failed++;
+    }
+
+    if (write(fd, "01\n", 3) != 3 || !readBoard(fd, buf)){
+        fprintf(stderr, "ring: no room again once read\n");
+        failed++;
+    }
+
+    close(fd);
+
+    printf("ring: %u responses queued before EAGAIN, %d failed\n", queued, failed);
+
+    return failed != 0;
+}
+
+
+
+int main(int argc, char **argv)
+{
+    static const char *names[NCMDS] = {"00 new game", "01 board", "02 move", "03 computer"};
+
+    pthread_t threads[MAX_CLIENTS];
+    struct samples all[NCMDS];
+    unsigned long long total = 0, games = 0;
+    int nclients = 4;
+    int seconds = 5;
+    unsigned int max_depth;
+    int opt, k, cmd;
+
+    while ((opt = getopt(argc, argv, "c:s:d:t:m:iur")) != -1){
+        switch (opt){
+        case 'c':
+            nclients = atoi(optarg);
+            break;
+        case 's':
+            seconds = atoi(optarg);
+            break;
+        case 'd':
+            depth = atoi(optarg);
+            break;
+        case 't':
+            move_ms = atoi(optarg);
+            break;
+        case 'm':
+            max_moves = atoi(optarg);
+            break;
+        case 'i':
+            backend = BACKEND_IOCTL;
+            break;
+        case 'u':
+            backend = BACKEND_ENGINE;
+            break;
+        case 'r':
+            return checkRing();
+        default:
+            fprintf(stderr, "usage: %s [-c clients] [-s seconds] [-d depth] [-t ms] [-m moves] [-i | -u | -r]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    //the module searches no deeper than its own MAX_DEPTH, the in process engine to ours
+    max_depth = (backend == BACKEND_ENGINE) ? MAX_DEPTH : CHESS_MAX_DEPTH;
+
+    if (nclients < 1 || nclients > MAX_CLIENTS || seconds < 1 || depth > max_depth || max_moves < 1){
+        fprintf(stderr, "clients must be 1 to %d, seconds and moves at least 1, depth at most %u\n", MAX_CLIENTS, max_depth);
+        return 1;
+    }
+
+    if (backend == BACKEND_ENGINE){
+        unsigned long buckets = LOAD_TT_MB * 1024UL * 1024 / sizeof(struct tt_bucket);
+
+        tt = aligned_alloc(sizeof(struct tt_bucket), buckets * sizeof(struct tt_bucket));
+
+        if (tt == NULL){
+            perror("transposition table");
+            return 1;
+        }
+
+        memset(tt, 0, buckets * sizeof(struct tt_bucket));
+        tt_mask = buckets - 1;
+    }
+
+    for (k = 0; k < nclients; k++){
+        if (openClient(&clients[k], k)){
+            return 1;
+        }
+    }
+
+    for (k = 0; k < nclients; k++){
+        pthread_create(&threads[k], NULL, client, &clients[k]);
+    }
+
+    sleep(seconds);
+    __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+
+    for (k = 0; k < nclients; k++){
+        pthread_join(threads[k], NULL);
+        games += clients[k].games;
+    }
+
+    //every client's samples of a command, pooled
+    memset(all, 0, sizeof(all));
+
+    for (cmd = 0; cmd < NCMDS; cmd++){
+        for (k = 0; k < nclients; k++){
+            struct samples *smp = &clients[k].cmds[cmd];
+            size_t n;
+
+            for (n = 0; n < smp->n; n++){
+                record(&all[cmd], smp->ns[n]);
+            }
+        }
+
+        qsort(all[cmd].ns, all[cmd].n, sizeof(*all[cmd].ns), compare);
+        total += all[cmd].n;
+    }
+
+    printf("%s clients %d: %llu commands/s, %llu games\n", backends[backend].name, nclients, total / seconds, games);
+    printf("%-12s %10s %12s %12s %12s %12s\n", "command", "count", "p50 us", "p99 us", "p999 us", "max us");
+
+    for (cmd = 0; cmd < NCMDS; cmd++){
+        if (all[cmd].n == 0){
+            continue;
+        }
+
+        printf("%-12s %10zu %12.1f %12.1f %12.1f %12.1f\n", names[cmd], all[cmd].n,
+               percentile(&all[cmd], 0.5), percentile(&all[cmd], 0.99), percentile(&all[cmd], 0.999),
+               all[cmd].ns[all[cmd].n - 1] / 1000.0);
+    }
+
+    return 0;
+}
@@ -0,0 +1,384 @@
+/*host side generator for chess_tables.h.
+
+  Everything chess.c needs to know about board geometry is computed here
+  once, at build time, and written out as static const tables: the leaper
+  (king, knight, pawn) attack sets, the empty board rook and bishop rays,
+  the squares between and the full line through any two squares, and the
+  rook/bishop magic bitboard tables, and the Zobrist keys used to hash
+  positions. The module then only ever does table lookups, nothing is
+  computed in game_init(), and the tables end up in read-only pages.
+
+  usage: gentables > chess_tables.h*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+typedef uint64_t u64;
+
+
+//square index of row i, column j, a1 = 0, h1 = 7, a8 = 56
+#define SQ(i, j)    ((i) * 8 + (j))
+
+
+static const int rook_dirs[4][2] = {{1, 0}, {-1, 0}, {0, 1}, {0, -1}};
+static const int bishop_dirs[4][2] = {{1, 1}, {1, -1}, {-1, 1}, {-1, -1}};
+
+static const int king_steps[8][2] = {{1, 0}, {-1, 0}, {0, 1}, {0, -1}, {1, 1}, {1, -1}, {-1, 1}, {-1, -1}};
+static const int knight_steps[8][2] = {{1, 2}, {2, 1}, {-1, 2}, {-2, 1}, {1, -2}, {2, -1}, {-1, -2}, {-2, -1}};
+static const int wpawn_steps[2][2] = {{1, 1}, {1, -1}};
+static const int bpawn_steps[2][2] = {{-1, 1}, {-1, -1}};
+
+
+/*these mirror the tables in the generated header. magic offsets are
+  written out as an index into the shared attack table*/
+struct magic {
+    u64 mask;
+    u64 magic;
+    unsigned int offset;
+    unsigned int shift;
+};
+
+static u64 king_attacks[64];
+static u64 knight_attacks[64];
+static u64 pawn_attacks[2][64];
+
+static u64 rook_rays[64];
+static u64 bishop_rays[64];
+
+static u64 between_masks[64][64];
+static u64 line_masks[64][64];
+
+static struct magic rook_magics[64];
+static struct magic bishop_magics[64];
+
+//shared attack tables, sized for the sum of 2^bits over all squares
+static u64 rook_table[102400];
+static u64 bishop_table[5248];
+
+/*one random key per colour, piece type and square, and one for black
+  to move. Type 0 (empty) is never hashed and stays 0*/
+static u64 zobrist_pieces[2][7][64];
+static u64 zobrist_side;
+
+//scratch space for findMagic()
+static u64 occupancies[4096];
+static u64 references[4096];
+
+
+
+//attack set of a leaper on sq for a list of (row, column) steps
+static u64 leaperAttacks(int sq, const int steps[][2], int nsteps)
+{
+    int k;
+    u64 set = 0;
+
+    for (k = 0; k < nsteps; k++){
+        int i = sq / 8 + steps[k][0];
+        int j = sq % 8 + steps[k][1];
+
+        if (i >= 0 && i < 8 && j >= 0 && j < 8){
+            set |= 1ULL << SQ(i, j);
+        }
+    }
+
+    return set;
+}
+
+
+
+/*attack set of a slider on sq walking each direction until the edge or
+  the first blocker in occ. If mask is set, the walk stops one short of
+  the edge to give the relevant occupancy mask instead*/
+static u64 slidingAttacks(int sq, u64 occ, const int dirs[4][2], bool mask)
+{
+    int k;
+    u64 set = 0;
+
+    for (k = 0; k < 4; k++){
+        int i = sq / 8 + dirs[k][0];
+        int j = sq % 8 + dirs[k][1];
+
+        while (i >= 0 && i < 8 && j >= 0 && j < 8){
+            int ni = i + dirs[k][0];
+            int nj = j + dirs[k][1];
+
+            //for the mask, the last square on a ray never matters
+            if (mask && (ni < 0 || ni > 7 || nj < 0 || nj > 7)){
+                break;
+            }
+
+            set |= 1ULL << SQ(i, j);
+
+            if (occ & (1ULL << SQ(i, j))){
+                break;
+            }
+
+            i = ni;
+            j = nj;
+        }
+    }
+
+    return set;
+}
+
+
+
+//xorshift64* generator used for trying magic candidates
+static u64 magicRandom(u64 *state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+
+    return *state * 2685821657736338717ULL;
+}
+
+
+
+/*finds a magic number for sq by trial, filling m and its slice of the
+  attack table starting at table[offset]. Returns the number of entries used*/
+static unsigned int findMagic(struct magic *m, u64 *table, unsigned int offset, int sq, const int dirs[4][2], u64 *seed)
+{
+    u64 subset = 0;
+    unsigned int size = 0;
+    unsigned int k;
+
+    m->mask = slidingAttacks(sq, 0, dirs, true);
+    m->shift = 64 - __builtin_popcountll(m->mask);
+    m->offset = offset;
+    table += offset;
+
+    /*enumerate every subset of the mask (Carry-Rippler trick)
+      along with the true attack set for that subset*/
+    do {
+        occupancies[size] = subset;
+        references[size] = slidingAttacks(sq, subset, dirs, false);
+        size++;
+        subset = (subset - m->mask) & m->mask;
+    } while (subset);
+
+    for (;;){
+        bool ok = true;
+
+        //sparse candidates are far more likely to work
+        m->magic = magicRandom(seed) & magicRandom(seed) & magicRandom(seed);
+
+        if (__builtin_popcountll((m->mask * m->magic) >> 56) < 6){
+            continue;
+        }
+
+        memset(table, 0, size * sizeof(u64));
+
+        for (k = 0; k < size && ok; k++){
+            unsigned int idx = (unsigned int)((occupancies[k] * m->magic) >> m->shift);
+
+            /*a collision is only harmful if the two subsets
+              have different attack sets (0 is never a valid set)*/
+            if (table[idx] == 0){
+                table[idx] = references[k];
+            }
+
+            else if (table[idx] != references[k]){
+                ok = false;
+            }
+        }
+
+        if (ok){
+            return size;
+        }
+    }
+}
+
+
+
+/*fills between_masks and line_masks. For two squares on a common rank,
+  file or diagonal, between is the squares strictly in between and line
+  is the whole line through both, edge to edge. Otherwise both are 0*/
+static void initLines(void)
+{
+    int a, b, k;
+
+    for (a = 0; a < 64; a++){
+        for (k = 0; k < 8; k++){
+            const int *dir = (k < 4) ? rook_dirs[k] : bishop_dirs[k - 4];
+            u64 ray = slidingAttacks(a, 0, (k < 4) ? rook_dirs : bishop_dirs, false);
+            u64 path = 0;
+            int i = a / 8 + dir[0];
+            int j = a % 8 + dir[1];
+
+            while (i >= 0 && i < 8 && j >= 0 && j < 8){
+                b = SQ(i, j);
+
+                between_masks[a][b] = path;
+
+                /*the line is both rays of this orientation through a,
+                  i.e. the rook or bishop rays of a cut down to the ones
+                  that also contain b's side of the board*/
+                line_masks[a][b] = (ray & (slidingAttacks(b, 0, (k < 4) ? rook_dirs : bishop_dirs, false) | (1ULL << b))) | (1ULL << a);
+
+                path |= 1ULL << b;
+                i += dir[0];
+                j += dir[1];
+            }
+        }
+    }
+}
+
+
+
+static void printRow(const u64 *table, int n, const char *indent)
+{
+    int k;
+
+    for (k = 0; k < n; k++){
+
+        //four entries to a line
+        if (k % 4 == 0){
+            printf("\n%s", indent);
+        }
+
+        else{
+            printf(" ");
+        }
+
+        printf("0x%016llxULL,", (unsigned long long) table[k]);
+    }
+}
+
+
+
+static void printTable(const char *decl, const u64 *table, int n)
+{
+    printf("%s = {", decl);
+    printRow(table, n, "    ");
+    printf("\n};\n\n");
+}
+
+
+
+//same as printTable() for a [rows][64] table, one braced row at a time
+static void printTable2(const char *decl, const u64 *table, int rows)
+{
+    int r;
+
+    printf("%s = {", decl);
+
+    for (r = 0; r < rows; r++){
+        printf("\n    {");
+        printRow(table + r * 64, 64, "        ");
+        printf("\n    },");
+    }
+
+    printf("\n};\n\n");
+}
+
+
+
+//same again for a [2][7][64] table
+static void printTable3(const char *decl, const u64 *table)
+{
+    int c, r;
+
+    printf("%s = {", decl);
+
+    for (c = 0; c < 2; c++){
+        printf("\n    {");
+
+        for (r = 0; r < 7; r++){
+            printf("\n        {");
+            printRow(table + (c * 7 + r) * 64, 64, "            ");
+            printf("\n        },");
+        }
+
+        printf("\n    },");
+    }
+
+    printf("\n};\n\n");
+}
+
+
+
+static void printMagics(const char *name, const struct magic *magics, const char *table)
+{
+    int sq;
+
+    printf("static const struct magic %s[64] = {\n", name);
+
+    for (sq = 0; sq < 64; sq++){
+        printf("    {0x%016llxULL, 0x%016llxULL, %s + %u, %u},\n",
+               (unsigned long long) magics[sq].mask, (unsigned long long) magics[sq].magic,
+               table, magics[sq].offset, magics[sq].shift);
+    }
+
+    printf("};\n\n");
+}
+
+
+
+int main(void)
+{
+    u64 seed = 0x9e3779b97f4a7c15ULL;
+    unsigned int rook_next = 0;
+    unsigned int bishop_next = 0;
+    int sq;
+
+    for (sq = 0; sq < 64; sq++){
+        king_attacks[sq] = leaperAttacks(sq, king_steps, 8);
+        knight_attacks[sq] = leaperAttacks(sq, knight_steps, 8);
+        pawn_attacks[0][sq] = leaperAttacks(sq, wpawn_steps, 2);
+        pawn_attacks[1][sq] = leaperAttacks(sq, bpawn_steps, 2);
+
+        rook_rays[sq] = slidingAttacks(sq, 0, rook_dirs, false);
+        bishop_rays[sq] = slidingAttacks(sq, 0, bishop_dirs, false);
+
+        rook_next += findMagic(&rook_magics[sq], rook_table, rook_next, sq, rook_dirs, &seed);
+        bishop_next += findMagic(&bishop_magics[sq], bishop_table, bishop_next, sq, bishop_dirs, &seed);
+    }
+
+    initLines();
+
+    //the keys come from their own fixed seed so they never depend on the magic search
+    seed = 0x2545f4914f6cdd1dULL;
+
+    for (sq = 0; sq < 64; sq++){
+        int c, t;
+
+        for (c = 0; c < 2; c++){
+            for (t = 1; t < 7; t++){
+                zobrist_pieces[c][t][sq] = magicRandom(&seed);
+            }
+        }
+    }
+
+    zobrist_side = magicRandom(&seed);
+
+    printf("/*generated by gentables, do not edit*/\n\n");
+    printf("#ifndef CHESS_TABLES_H\n#define CHESS_TABLES_H\n\n");
+
+    printf("struct magic {\n    u64 mask;\n    u64 magic;\n    const u64 *attacks;\n    unsigned int shift;\n};\n\n");
+
+    printTable("static const u64 king_attacks[64]", king_attacks, 64);
+    printTable("static const u64 knight_attacks[64]", knight_attacks, 64);
+    printTable2("static const u64 pawn_attacks[2][64]", &pawn_attacks[0][0], 2);
+
+    printTable("static const u64 rook_rays[64]", rook_rays, 64);
+    printTable("static const u64 bishop_rays[64]", bishop_rays, 64);
+
+    printTable2("static const u64 between_masks[64][64]", &between_masks[0][0], 64);
+    printTable2("static const u64 line_masks[64][64]", &line_masks[0][0], 64);
+
+    printTable("static const u64 rook_table[102400]", rook_table, rook_next);
+    printTable("static const u64 bishop_table[5248]", bishop_table, bishop_next);
+
+    printMagics("rook_magics", rook_magics, "rook_table");
+    printMagics("bishop_magics", bishop_magics, "bishop_table");
+
+    printTable3("static const u64 zobrist_pieces[2][7][64]", &zobrist_pieces[0][0][0]);
+    printf("static const u64 zobrist_side = 0x%016llxULL;\n\n", (unsigned long long) zobrist_side);
+
+    printf("#endif\n");
+
+    return 0;
+}